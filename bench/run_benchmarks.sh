@@ -0,0 +1,164 @@
+#!/bin/bash
+# Benchmarks the counters programs on the genomes in genomes/ and writes the results to
+# $OUT_DIR/results.csv and $OUT_DIR/results.json. For each k in $K_VALUES, builds an index of
+# the genomes and then times single- and multi-genome counting in every output format, and the
+# k-mer dump. The counting runs are repeated with each huge page mode in $HUGE_PAGE_MODES to
+# compare against the default regular pages, and with sorted batched updates for each batch
+# size in $BATCH_SIZES. These runs are sequential and recorded with 1 thread. The NUMA, dense
+# and decompression runs are repeated for each thread count in $THREAD_COUNTS.
+#
+# Requires GNU time (apt-get install time) for the peak RSS.
+#
+# Run from the root of the repository, or through `make bench` / the CMake `bench` target.
+
+set -ue
+
+REPO_DIR=$(cd "$(dirname "$0")/.." && pwd)
+TOOLS_DIR=${TOOLS_DIR:-$REPO_DIR}                     # Directory of the counters binaries
+SBWT_BIN=${SBWT_BIN:-$REPO_DIR/SBWT/build/bin/sbwt}   # The sbwt executable used to build the indexes
+OUT_DIR=${OUT_DIR:-$REPO_DIR/temp/bench}
+K_VALUES=${K_VALUES:-"21 31"}
+THREAD_COUNTS=${THREAD_COUNTS:-"1 4"}               # Passed to the parallel runs as --n-threads or --decompression-threads
+HUGE_PAGE_MODES=${HUGE_PAGE_MODES:-"transparent explicit"} # Passed to the counters as --huge-pages
+BATCH_SIZES=${BATCH_SIZES:-"65536 1048576 16777216"}  # Passed to the counters as --batch-size
+TIME_BIN=${TIME_BIN:-/usr/bin/time}
+
+mkdir -p "$OUT_DIR"
+ls "$REPO_DIR"/genomes/*.fna > "$OUT_DIR/genomes.txt"
+
+# Gzipped copies of the genomes, and BGZF copies if bgzip is installed, to compare the
+# throughput on compressed inputs with the uncompressed files
+mkdir -p "$OUT_DIR/compressed"
+: > "$OUT_DIR/genomes-gzip.txt"
+: > "$OUT_DIR/genomes-bgzf.txt"
+for f in $(cat "$OUT_DIR/genomes.txt"); do
+    name=$(basename "$f")
+    gzip -c "$f" > "$OUT_DIR/compressed/$name.gz"
+    echo "$OUT_DIR/compressed/$name.gz" >> "$OUT_DIR/genomes-gzip.txt"
+    if command -v bgzip > /dev/null; then
+        bgzip -c "$f" > "$OUT_DIR/compressed/$name.bgz"
+        echo "$OUT_DIR/compressed/$name.bgz" >> "$OUT_DIR/genomes-bgzf.txt"
+    fi
+done
+FIRST_GENOME=$(head -n 1 "$OUT_DIR/genomes.txt")
+CSV="$OUT_DIR/results.csv"
+LOG="$OUT_DIR/bench.log"
+echo "benchmark,k,threads,format,wall_seconds,kmers_per_second,peak_rss_kb,bytes_written" > "$CSV"
+: > "$LOG"
+
+# Number of k-mers in the given FASTA files, i.e. the number of searches made by the counters
+count_kmers(){
+    local k=$1; shift
+    awk -v k="$k" '
+        /^>/ { if(len >= k) total += len - k + 1; len = 0; next }
+        { len += length($0) }
+        END { if(len >= k) total += len - k + 1; print total + 0 }' "$@"
+}
+
+# measure <benchmark> <k> <threads> <format> <n_kmers> <command...>
+# Runs the command with its standard output going to a file and appends one row to the CSV.
+measure(){
+    local name=$1 k=$2 threads=$3 format=$4 n_kmers=$5; shift 5
+    local out="$OUT_DIR/$name-k$k-t$threads-$format.out"
+    echo "== $name k=$k threads=$threads format=$format: $*" >> "$LOG"
+    "$TIME_BIN" -f "%e %M" -o "$OUT_DIR/time.txt" "$@" > "$out" 2>> "$LOG"
+    local wall rss
+    read wall rss < <(tail -n 1 "$OUT_DIR/time.txt")
+    local bytes=$(stat -c %s "$out")
+    local kps=$(awk -v n="$n_kmers" -v t="$wall" 'BEGIN { printf "%.0f", (t > 0 ? n / t : 0) }')
+    echo "$name,$k,$threads,$format,$wall,$kps,$rss,$bytes" >> "$CSV"
+    echo "$name k=$k threads=$threads format=$format: ${wall}s, $kps k-mers/s, peak RSS ${rss} kB, $bytes bytes"
+    rm -f "$out"
+}
+
+# Drops the page cache so that the next run reads its inputs from disk. Needs root; returns
+# false without it.
+drop_page_cache(){
+    [ "$(id -u)" -eq 0 ] && [ -w /proc/sys/vm/drop_caches ] || return 1
+    sync
+    echo 3 > /proc/sys/vm/drop_caches
+}
+
+for k in $K_VALUES; do
+    INDEX="$OUT_DIR/index-k$k.sbwt"
+    "$SBWT_BIN" build -i "$OUT_DIR/genomes.txt" -o "$INDEX" -k "$k" --temp-dir "$OUT_DIR" >> "$LOG" 2>&1
+
+    ALL_KMERS=$(count_kmers "$k" $(cat "$OUT_DIR/genomes.txt"))
+    FIRST_KMERS=$(count_kmers "$k" "$FIRST_GENOME")
+    N_NODES=$("$TOOLS_DIR/dump_kmers" "$INDEX" 2> /dev/null | wc -l)
+
+    # The sequential rows ignore --n-threads, so they run once and are recorded with 1 thread
+    threads=1
+    for format in handles with-kmers binary unitigs; do
+        case $format in
+            handles) flags="" ;;
+            with-kmers) flags="--with-kmers" ;;
+            binary) flags="--with-kmers --binary" ;;
+            unitigs) flags="--unitigs" ;;
+        esac
+        measure multi_genome_counters "$k" "$threads" "$format" "$ALL_KMERS" \
+            "$TOOLS_DIR/multi_genome_counters" "$INDEX" "$OUT_DIR/genomes.txt" $flags
+        measure single_genome_counters "$k" "$threads" "$format" "$FIRST_KMERS" \
+            "$TOOLS_DIR/single_genome_counters" "$INDEX" "$FIRST_GENOME" $flags
+    done
+    # The list workflow without reading ahead, with the io_uring reader (the default) and
+    # with the thread-pool reader. As root, the page cache is dropped before each run to
+    # measure cold reads. Otherwise the files are cached and the rows are tagged -warm.
+    for read_ahead in off io_uring threads; do
+        case $read_ahead in
+            off) flags="--read-ahead 0" ;;
+            *) flags="--read-backend $read_ahead" ;;
+        esac
+        format="handles-read-ahead-$read_ahead"
+        if drop_page_cache; then :; else format="$format-warm"; fi
+        measure multi_genome_counters "$k" "$threads" "$format" "$ALL_KMERS" \
+            "$TOOLS_DIR/multi_genome_counters" "$INDEX" "$OUT_DIR/genomes.txt" $flags
+    done
+    for batch in $BATCH_SIZES; do
+        measure multi_genome_counters "$k" "$threads" "handles-batch-$batch" "$ALL_KMERS" \
+            "$TOOLS_DIR/multi_genome_counters" "$INDEX" "$OUT_DIR/genomes.txt" --batch-size "$batch"
+        measure single_genome_counters "$k" "$threads" "handles-batch-$batch" "$FIRST_KMERS" \
+            "$TOOLS_DIR/single_genome_counters" "$INDEX" "$FIRST_GENOME" --batch-size "$batch"
+    done
+    for mode in $HUGE_PAGE_MODES; do
+        measure multi_genome_counters "$k" "$threads" "handles-huge-pages-$mode" "$ALL_KMERS" \
+            "$TOOLS_DIR/multi_genome_counters" "$INDEX" "$OUT_DIR/genomes.txt" --huge-pages "$mode"
+        measure single_genome_counters "$k" "$threads" "handles-huge-pages-$mode" "$FIRST_KMERS" \
+            "$TOOLS_DIR/single_genome_counters" "$INDEX" "$FIRST_GENOME" --huge-pages "$mode"
+    done
+    measure dump_kmers "$k" "$threads" text "$N_NODES" "$TOOLS_DIR/dump_kmers" "$INDEX"
+    measure dump_kmers "$k" "$threads" binary "$N_NODES" "$TOOLS_DIR/dump_kmers" "$INDEX" --binary
+
+    # The parallel rows, once per thread count
+    for threads in $THREAD_COUNTS; do
+        measure multi_genome_counters "$k" "$threads" handles-numa "$ALL_KMERS" \
+            "$TOOLS_DIR/multi_genome_counters" "$INDEX" "$OUT_DIR/genomes.txt" --n-threads "$threads" --numa
+        measure multi_genome_counters "$k" "$threads" handles-numa-replicated "$ALL_KMERS" \
+            "$TOOLS_DIR/multi_genome_counters" "$INDEX" "$OUT_DIR/genomes.txt" --n-threads "$threads" --numa --numa-replicate-index
+        for updates in atomic buffered; do
+            measure single_genome_counters "$k" "$threads" "handles-dense-$updates" "$FIRST_KMERS" \
+                "$TOOLS_DIR/single_genome_counters" "$INDEX" "$FIRST_GENOME" --n-threads "$threads" --dense --dense-updates "$updates"
+        done
+        for compression in gzip bgzf; do
+            [ -s "$OUT_DIR/genomes-$compression.txt" ] || continue
+            measure multi_genome_counters "$k" "$threads" "handles-$compression" "$ALL_KMERS" \
+                "$TOOLS_DIR/multi_genome_counters" "$INDEX" "$OUT_DIR/genomes-$compression.txt" \
+                --decompression-threads "$threads"
+        done
+    done
+done
+
+# The same rows as JSON
+awk -F, '
+    NR == 1 { for(i = 1; i <= NF; i++) key[i] = $i; printf "["; next }
+    {
+        printf "%s\n  {", (NR > 2 ? "," : "")
+        for(i = 1; i <= NF; i++){
+            numeric = ($i ~ /^[0-9.]+$/)
+            printf "%s\"%s\": %s%s%s", (i > 1 ? ", " : ""), key[i], (numeric ? "" : "\""), $i, (numeric ? "" : "\"")
+        }
+        printf "}"
+    }
+    END { print "\n]" }' "$CSV" > "$OUT_DIR/results.json"
+
+echo "Results written to $CSV and $OUT_DIR/results.json"
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Splits the command line into positional arguments and --options. Options listed in
+// `flags` take no value, and options listed in `value_options` take the next argument as
+// their value. Any other option is an error, so that a misspelled or unsupported option is
+// not silently ignored.
+class CommandLine{
+
+    map<string, string> options;
+
+public:
+
+    vector<string> positional;
+
+    CommandLine(int argc, char** argv, const set<string>& flags, const set<string>& value_options){
+        for(int64_t i = 1; i < argc; i++){
+            string arg = argv[i];
+            if(arg.size() > 2 && arg.substr(0, 2) == "--"){
+                string name = arg.substr(2);
+                if(flags.count(name)) options[name] = "";
+                else if(!value_options.count(name)){
+                    cerr << "Error: unknown option --" << name << endl;
+                    exit(1);
+                } else if(i + 1 < argc) options[name] = argv[++i];
+                else{
+                    cerr << "Error: missing value for --" << name << endl;
+                    exit(1);
+                }
+            } else positional.push_back(arg);
+        }
+    }
+
+    bool has(const string& name) const{
+        return options.count(name) > 0;
+    }
+
+    string get(const string& name, const string& default_value) const{
+        auto it = options.find(name);
+        return it == options.end() ? default_value : it->second;
+    }
+
+    int64_t get_int(const string& name, int64_t default_value) const{
+        auto it = options.find(name);
+        if(it == options.end()) return default_value;
+        try{
+            return stoll(it->second);
+        } catch(...){
+            cerr << "Error: --" << name << " expects an integer, got " << it->second << endl;
+            exit(1);
+        }
+    }
+
+};
@@ -0,0 +1,257 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <regex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+static const string COLOR_BY_USAGE =
+    "  --color-by mode      file: one color per input file (default)\n"
+    "                       record: one color per sequence record, named by the record id\n"
+    "                       regex: one color per group of records, named by the first capture group\n"
+    "                       (or the whole match) of --color-regex on the header\n"
+    "  --color-regex re     The regular expression (ECMAScript) for --color-by regex\n"
+    "  --color-names file   Write the color id -> name table to this file as tab-separated text\n"
+    "  --groups file.tsv    With --color-by file: lines of file path, tab, group name. The files of a\n"
+    "                       group are counted as one color named by the group. Other files get their\n"
+    "                       own colors.\n";
+
+static const string STREAM_USAGE =
+    "  Listed files may be - for standard input, or named pipes. With --color-by file, a line\n"
+    "  #SBWT-COLOR name in an input starts a new color called name, so that one stream can carry\n"
+    "  many genomes (not with --numa).\n";
+
+static const string COLOR_METADATA_USAGE =
+    "  --color-metadata file  Write the name and input statistics of every color to this binary file\n"
+    "                         (see colors.hh)\n";
+
+enum class ColorBy{FILE, RECORD, REGEX};
+
+static inline ColorBy parse_color_by(const string& name){
+    if(name == "file") return ColorBy::FILE;
+    if(name == "record") return ColorBy::RECORD;
+    if(name == "regex") return ColorBy::REGEX;
+    cerr << "Error: unknown color mode " << name << " (expected file, record or regex)" << endl;
+    exit(1);
+}
+
+// Color id -> name, with all names in one buffer so that millions of colors cost little more
+// than the names themselves
+class ColorNames{
+
+    string buffer;
+    vector<int64_t> ends = {0};
+
+public:
+
+    // Returns the id of the new color
+    int32_t add(string_view name){
+        buffer.append(name);
+        ends.push_back(buffer.size());
+        return ends.size() - 2;
+    }
+
+    // Removes the newest color
+    void pop_back(){
+        ends.pop_back();
+        buffer.resize(ends.back());
+    }
+
+    int64_t size() const{
+        return ends.size() - 1;
+    }
+
+    string_view operator[](int64_t color) const{
+        return string_view(buffer).substr(ends[color], ends[color+1] - ends[color]);
+    }
+
+    // One line per color: id, tab, name
+    void write_tsv(ostream& out) const{
+        for(int64_t color = 0; color < size(); color++) out << color << '\t' << (*this)[color] << '\n';
+    }
+
+};
+
+// File path -> group name from a --groups file. Empty lines and lines starting with # are
+// skipped.
+static inline unordered_map<string, string> read_groups_file(const string& filename){
+    ifstream in(filename);
+    if(!in.good()){
+        cerr << "Error: could not open " << filename << endl;
+        exit(1);
+    }
+    unordered_map<string, string> groups;
+    string line;
+    int64_t line_number = 0;
+    while(getline(in, line)){
+        line_number++;
+        if(line.size() > 0 && line.back() == '\r') line.pop_back();
+        if(line.empty() || line[0] == '#') continue;
+        size_t tab = line.find('\t');
+        if(tab == string::npos || tab == 0 || tab + 1 == line.size()){
+            cerr << "Error: line " << line_number << " of " << filename << " is not a file path and a group name separated by a tab" << endl;
+            exit(1);
+        }
+        groups[line.substr(0, tab)] = line.substr(tab + 1);
+    }
+    return groups;
+}
+
+// Assigns colors to the records of the input files in the order they are counted
+class ColorAssigner{
+
+    ColorBy mode;
+    std::regex pattern;
+    unordered_map<string, string> file_groups; // File path -> group name, from --groups
+    unordered_map<string, int32_t> group_colors; // Group name -> color, for --groups and REGEX mode
+    int32_t file_color = -1;
+    bool file_color_named_by_file = false; // The file color is new, named by the file and has no records yet
+
+    int32_t group_color(const string& group){
+        auto it = group_colors.find(group);
+        if(it != group_colors.end()) return it->second;
+        int32_t color = names.add(group);
+        group_colors[group] = color;
+        return color;
+    }
+
+    // The record id: the header up to the first whitespace
+    static string_view record_id(const char* header, int64_t length){
+        int64_t end = 0;
+        while(end < length && header[end] != ' ' && header[end] != '\t') end++;
+        return string_view(header, end);
+    }
+
+public:
+
+    ColorNames names;
+
+    ColorAssigner(ColorBy mode, const string& regex = "", unordered_map<string, string> file_groups = {})
+        : mode(mode), file_groups(std::move(file_groups)){
+        if(mode == ColorBy::REGEX){
+            try{
+                pattern = std::regex(regex, std::regex::ECMAScript | std::regex::optimize);
+            } catch(const std::regex_error& e){
+                cerr << "Error: invalid --color-regex " << regex << ": " << e.what() << endl;
+                exit(1);
+            }
+        }
+    }
+
+    // Called before the records of each input file. Returns the color of the file in FILE mode.
+    int32_t start_file(const string& filename){
+        if(mode != ColorBy::FILE) return -1;
+        auto it = file_groups.find(filename);
+        file_color = it == file_groups.end() ? names.add(filename) : group_color(it->second);
+        file_color_named_by_file = it == file_groups.end();
+        return file_color;
+    }
+
+    // Called at a frame line of a framed stream. In FILE mode, the records up to the next frame
+    // get the color named by the frame, or by its group if the name is in --groups. If the
+    // stream starts with a frame, the stream itself gets no color.
+    void start_frame(const string& name){
+        if(mode != ColorBy::FILE) return;
+        if(file_color_named_by_file) names.pop_back();
+        auto it = file_groups.find(name);
+        file_color = it == file_groups.end() ? names.add(name) : group_color(it->second);
+        file_color_named_by_file = false;
+    }
+
+    // The color of the next record. Headers that the regex does not match are grouped by their
+    // record id.
+    int32_t color_of_record(const char* header, int64_t length){
+        if(mode == ColorBy::FILE){
+            file_color_named_by_file = false;
+            return file_color;
+        }
+        if(mode == ColorBy::RECORD) return names.add(record_id(header, length));
+
+        std::cmatch match;
+        string group;
+        if(std::regex_search(header, header + length, match, pattern)) group = match.size() > 1 ? match[1].str() : match[0].str();
+        else group = record_id(header, length);
+        return group_color(group);
+    }
+
+    // Writes the names to the file given by --color-names
+    void write_names(const string& filename) const{
+        ofstream out(filename);
+        if(!out.good()){
+            cerr << "Error: could not write " << filename << endl;
+            exit(1);
+        }
+        names.write_tsv(out);
+    }
+
+};
+
+// Input statistics of a color, collected while counting
+struct ColorStats{
+    int64_t records = 0;
+    int64_t bases = 0; // Total sequence length of the records
+    int64_t kmers_searched = 0; // K-mers of valid bases looked up in the index
+    int64_t kmers_found = 0;
+
+    void add(const ColorStats& S){
+        records += S.records;
+        bases += S.bases;
+        kmers_searched += S.kmers_searched;
+        kmers_found += S.kmers_found;
+    }
+};
+
+// Binary color metadata file: the magic string below and the number of colors as 64-bit
+// fields, then for each color in id order the length of its name, the name, and the 64-bit
+// fields records, bases, kmers_searched and kmers_found of its ColorStats. All integers are
+// little-endian.
+static const string COLOR_METADATA_MAGIC = "SBWTCLR1";
+
+// Color id -> ColorStats, grown as colors appear
+class ColorMetadata{
+
+    vector<ColorStats> stats;
+
+    static void write_int(ostream& out, uint64_t x){
+        out.write((const char*)&x, sizeof(x));
+    }
+
+public:
+
+    ColorStats& operator[](int32_t color){
+        if(color >= (int64_t)stats.size()) stats.resize(color + 1);
+        return stats[color];
+    }
+
+    void merge(const ColorMetadata& other){
+        for(int64_t color = 0; color < other.stats.size(); color++) (*this)[color].add(other.stats[color]);
+    }
+
+    void write(ostream& out, const ColorNames& names){
+        out.write(COLOR_METADATA_MAGIC.data(), COLOR_METADATA_MAGIC.size());
+        write_int(out, names.size());
+        for(int64_t color = 0; color < names.size(); color++){
+            const ColorStats& S = (*this)[color];
+            write_int(out, names[color].size());
+            out.write(names[color].data(), names[color].size());
+            for(int64_t x : {S.records, S.bases, S.kmers_searched, S.kmers_found}) write_int(out, x);
+        }
+    }
+
+    // Writes the metadata to the file given by --color-metadata
+    void write(const string& filename, const ColorNames& names){
+        ofstream out(filename, ios::binary);
+        if(!out.good()){
+            cerr << "Error: could not write " << filename << endl;
+            exit(1);
+        }
+        write(out, names);
+    }
+
+};
@@ -0,0 +1,237 @@
+#pragma once
+
+#include "sbwt/SBWT.hh"
+#include "gzip_input.hh"
+#include "hugepages.hh"
+#include "mmap_parser.hh"
+#include "nucleotides.hh"
+#include "colors.hh"
+#include "radix_sort.hh"
+#include "read_ahead.hh"
+#include "stats.hh"
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace sbwt;
+
+struct Counter{
+    int32_t color;
+    int32_t count;
+};
+
+typedef vector<vector<Counter>, HugePageAllocator<vector<Counter>>> CounterTable; // K-mer handle -> list of counters
+typedef vector<bool, HugePageAllocator<bool>> HandleBitmap; // One bit per k-mer handle
+
+static const string BATCH_SIZE_USAGE =
+    "  --batch-size n  Collect the handles of n k-mers, sort them and update the counters in handle order\n"
+    "                  (default: 0, update in read order)\n";
+
+static const string MIN_QUALITY_USAGE =
+    "  --min-quality q  In FASTQ inputs, treat bases with Phred quality below q (Phred+33) as N, so that\n"
+    "                   k-mers with low-quality bases are not searched (default: 0, off)\n";
+
+// The Phred quality below which FASTQ bases break the sequence like N, or 0 for none. Set
+// once at startup.
+static inline int64_t& min_base_quality(){
+    static int64_t q = 0;
+    return q;
+}
+
+static inline int64_t parse_min_quality(int64_t q){
+    if(q < 0 || q > 93){
+        cerr << "Error: --min-quality must be between 0 and 93" << endl;
+        exit(1);
+    }
+    return q;
+}
+
+// Adds amount to the counter of the given color in a list of counters sorted by color,
+// creating the counter if needed. Counting colors in increasing order only ever touches the
+// last one.
+static inline void add_to_counter(vector<Counter>& list, int32_t color, int32_t amount){
+    if(list.size() > 0 && list.back().color == color){
+        list.back().count += amount;
+        return;
+    }
+    // Binary search, since with colors by record group a list can have millions of colors
+    int64_t pos = std::upper_bound(list.begin(), list.end(), color,
+                                   [](int32_t c, const Counter& C){ return c < C.color; }) - list.begin();
+    if(pos > 0 && list[pos-1].color == color) list[pos-1].count += amount;
+    else list.insert(list.begin() + pos, Counter{.color = color, .count = amount});
+}
+
+// Adds sorted handles to the counters of the given color with one addition per run of equal
+// handles. In handle order the counter table is written front to back instead of at random.
+static inline void add_sorted_handles(const vector<int64_t>& handles, int32_t color,
+                                      CounterTable& counters, HandleBitmap& kmer_handles_found){
+    for(int64_t i = 0; i < handles.size();){
+        int64_t j = i + 1;
+        while(j < handles.size() && handles[j] == handles[i]) j++;
+        add_to_counter(counters[handles[i]], color, j - i);
+        kmer_handles_found[handles[i]] = 1;
+        i = j;
+    }
+}
+
+// Calls on_header(ptr, length) with the header of each record that starts in bytes
+// [begin, end) of the file, where begin is a record start, then f(seq, length) on the
+// uppercased runs of at least k valid bases in the record (see for_each_base_run), and then
+// on_length(length) with the sequence length of the record. With min_base_quality(), FASTQ
+// bases below it also end the runs. Every valid k-mer of a record is in exactly one run. The
+// name of each frame line (see FRAME_MARKER) is passed to on_frame(name) before the records
+// that follow it. Uncompressed files are parsed in place from a memory mapping, or from
+// memory if the file was read ahead. Gzipped files and streams (see is_stream) are always read
+// whole, and gzip is decompressed on other threads. Counts the records to the reads of this
+// thread.
+template<typename R, typename H, typename F, typename L>
+void for_each_framed_record(const InputFile& file, int64_t k, R on_frame, H on_header, F f, L on_length, int64_t begin = 0, int64_t end = INT64_MAX){
+    ThreadStats& stats = instrumentation().local();
+    string buffer, masked;
+    char min_quality = 33 + min_base_quality();
+    auto runs = [&](const char* seq, int64_t length, const char* quality){
+        if(quality != nullptr && min_quality > 33) seq = mask_low_quality_bases(seq, quality, length, min_quality, masked);
+        for_each_base_run(seq, length, k, buffer, f);
+    };
+    auto report_frames = [&](vector<string>& frames){
+        for(const string& name : frames) on_frame(name);
+        frames.clear();
+    };
+    const char* data = file.data.data();
+    int64_t size = file.data.size();
+    bool stream = !file.loaded && is_stream(file.filename);
+    if(stream || (file.loaded ? is_gzip_header((const unsigned char*)data, size) : is_gzipped(file.filename))){
+        unique_ptr<SeqParser> reader = stream ? open_sequence_stream(file.filename)
+                                     : file.loaded ? open_sequence_buffer(data, size, file.filename) : open_sequence_file(file.filename);
+        int64_t length;
+        while((length = reader->next_record()) >= 0){
+            report_frames(reader->frames);
+            on_header(reader->header.data(), (int64_t)reader->header.size());
+            runs(reader->read_buf, length, reader->quality.size() == length ? reader->quality.data() : nullptr);
+            on_length(length);
+            ThreadStats::add(stats.reads, 1);
+        }
+        report_frames(reader->frames);
+    } else{
+        unique_ptr<MmapSeqParser> parser = file.loaded ? make_unique<MmapSeqParser>(data, size, k, begin, end)
+                                                       : make_unique<MmapSeqParser>(file.filename, k, begin, end);
+        auto header = [&](const char* ptr, int64_t length){
+            report_frames(parser->frames);
+            on_header(ptr, length);
+        };
+        auto pieces = [&](const char* seq, int64_t length){ runs(seq, length, parser->quality); };
+        while(parser->next_record(header, pieces)){
+            on_length(parser->record_length);
+            ThreadStats::add(stats.reads, 1);
+        }
+        report_frames(parser->frames);
+    }
+}
+
+// The on_frame of for_each_framed_record for counters that have one color per file
+static inline auto frames_not_supported(const string& filename){
+    return [filename](const string&){
+        cerr << "Error: " << filename << " has color frame lines (" << FRAME_MARKER << "name), which only multi_genome_counters without --numa supports" << endl;
+        exit(1);
+    };
+}
+
+// for_each_framed_record for files without frame lines
+template<typename H, typename F, typename L>
+void for_each_record(const InputFile& file, int64_t k, H on_header, F f, L on_length, int64_t begin = 0, int64_t end = INT64_MAX){
+    for_each_framed_record(file, k, frames_not_supported(file.filename), on_header, f, on_length, begin, end);
+}
+
+// for_each_record without the headers
+template<typename F>
+void for_each_sequence(const InputFile& file, int64_t k, F f, int64_t begin = 0, int64_t end = INT64_MAX){
+    for_each_record(file, k, [](const char*, int64_t){}, f, [](int64_t){}, begin, end);
+}
+
+// Adds the k-mers of all sequences in the file to the counters. The color of each record is
+// color_of_record(header, length), so consecutive records may have different colors. Frame
+// lines are passed to on_frame(name) before the header of the next record. With a
+// nonzero batch_size, the handles of batch_size k-mers, or of the k-mers up to the next color
+// change, are radix sorted and applied at once. If metadata is given, adds the statistics of
+// each record to its color.
+template<typename sbwt_t, typename R, typename C>
+void count_kmers_in_records(const sbwt_t& sbwt, const InputFile& file, R on_frame, C color_of_record,
+                            CounterTable& counters, HandleBitmap& kmer_handles_found, int64_t batch_size = 0,
+                            ColorMetadata* metadata = nullptr){
+    PhaseClock clock;
+    ThreadStats& stats = instrumentation().local();
+    vector<int64_t> batch, tmp;
+    int32_t color = 0;
+    auto flush = [&](){
+        radix_sort_handles(batch, tmp, counters.size() - 1);
+        add_sorted_handles(batch, color, counters, kmer_handles_found);
+        batch.clear();
+    };
+
+    auto on_header = [&](const char* header, int64_t length){
+        int32_t record_color = color_of_record(header, length);
+        if(record_color != color && batch.size() > 0) flush();
+        color = record_color;
+    };
+
+    ColorStats record; // Of the current record
+    auto on_length = [&](int64_t length){
+        record.records = 1;
+        record.bases = length;
+        if(metadata != nullptr) (*metadata)[color].add(record);
+        record = ColorStats();
+    };
+
+    for_each_framed_record(file, sbwt.get_k(), on_frame, on_header, [&](const char* seq, int64_t length){
+        clock.lap(Phase::PARSE);
+
+        // Search all k-mers of seq
+        vector<int64_t> handles = sbwt.streaming_search(seq, length);
+        clock.lap(Phase::SEARCH);
+
+        int64_t hits = 0;
+        for(int64_t handle : handles){
+            if(handle == -1) continue; // This k-mer does not exist in the index
+            hits++;
+            if(batch_size == 0){
+                add_to_counter(counters[handle], color, 1);
+                kmer_handles_found[handle] = 1;
+            } else batch.push_back(handle);
+        }
+        if(batch_size > 0 && batch.size() >= batch_size) flush();
+        clock.lap(Phase::UPDATE);
+
+        ThreadStats::add(stats.kmers_searched, handles.size());
+        ThreadStats::add(stats.hits, hits);
+        ThreadStats::add(stats.misses, handles.size() - hits);
+        record.kmers_searched += handles.size();
+        record.kmers_found += hits;
+    }, on_length);
+    clock.lap(Phase::PARSE);
+
+    if(batch.size() > 0) flush();
+    clock.lap(Phase::UPDATE);
+}
+
+// Adds the k-mers of all sequences in the file to the counters of the given color
+template<typename sbwt_t>
+void count_kmers_in_file(const sbwt_t& sbwt, const InputFile& file, int32_t color,
+                         CounterTable& counters, HandleBitmap& kmer_handles_found, int64_t batch_size = 0,
+                         ColorMetadata* metadata = nullptr){
+    count_kmers_in_records(sbwt, file, frames_not_supported(file.filename), [color](const char*, int64_t){ return color; },
+                           counters, kmer_handles_found, batch_size, metadata);
+}
+
+// The sequence files listed in a list file, one path per line. Empty lines are skipped.
+static inline vector<string> read_list_file(const string& list_filename){
+    throwing_ifstream file(list_filename);
+    vector<string> filenames;
+    string line;
+    while(getline(file.stream, line)){
+        if(line.size() > 0) filenames.push_back(line);
+    }
+    return filenames;
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include "sbwt/SBWT.hh"
+#include "cli.hh"
+#include "counters.hh"
+#include "kmer_labels.hh"
+#include "unitigs.hh"
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace sbwt;
+
+// One line per found handle: the handle followed by its (color: count) pairs.
+static inline void write_counters(ostream& out, const CounterTable& counters,
+                                  const HandleBitmap& kmer_handles_found){
+    for(int64_t i = 0; i < counters.size(); i++){
+        if(kmer_handles_found[i]){
+            out << i;
+            for(Counter C : counters[i]){
+                out << " (" << C.color << ": " << C.count << ")";
+            }
+            out << "\n";
+        }
+    }
+}
+
+// Like write_counters, but the rows start with the k-mer instead of the handle. P must hold
+// the labels of exactly the found handles.
+static inline void write_counters_with_kmers(ostream& out, const CounterTable& counters,
+                                             const HandleBitmap& kmer_handles_found, const PackedKmers& P){
+    int64_t record = 0;
+    for(int64_t i = 0; i < counters.size(); i++){
+        if(kmer_handles_found[i]){
+            out << P.to_string(record++);
+            for(Counter C : counters[i]){
+                out << " (" << C.color << ": " << C.count << ")";
+            }
+            out << "\n";
+        }
+    }
+}
+
+// Binary counter table: the magic string below, then the 64-bit fields k, words_per_kmer and
+// n_rows. Each row is the packed k-mer (see PackedKmers), the number of counters as a uint32
+// and that many (int32 color, int32 count) pairs. All integers are little-endian.
+static const string COUNTER_TABLE_MAGIC = "SBWTCNT1";
+
+static inline void write_counters_with_kmers_binary(ostream& out, const CounterTable& counters,
+                                                    const HandleBitmap& kmer_handles_found, const PackedKmers& P){
+    out.write(COUNTER_TABLE_MAGIC.data(), COUNTER_TABLE_MAGIC.size());
+    write_u64(out, P.k);
+    write_u64(out, P.words_per_kmer);
+    write_u64(out, P.size());
+
+    int64_t record = 0;
+    for(int64_t i = 0; i < counters.size(); i++){
+        if(kmer_handles_found[i]){
+            out.write((const char*)P.get(record++), P.words_per_kmer * sizeof(uint64_t));
+            uint32_t n_counters = counters[i].size();
+            out.write((const char*)&n_counters, sizeof(n_counters));
+            for(Counter C : counters[i]){
+                out.write((const char*)&C.color, sizeof(C.color));
+                out.write((const char*)&C.count, sizeof(C.count));
+            }
+        }
+    }
+}
+
+enum class OutputFormat{
+    HANDLES, // write_counters
+    KMERS, // write_counters_with_kmers
+    KMERS_BINARY, // write_counters_with_kmers_binary
+    UNITIGS, // write_unitigs
+};
+
+static const string OUTPUT_FORMAT_USAGE =
+    "  --with-kmers  Start each output row with the k-mer instead of the handle\n"
+    "  --binary      Write the k-mer rows as a binary counter table (see counters_output.hh)\n"
+    "  --unitigs     Merge non-branching paths of k-mers with identical counters into unitig rows\n"
+    "  --progress s  Print a progress line to stderr every s seconds\n"
+    "  --perf        Measure cycles, instructions, LLC and dTLB misses per phase with perf_event_open\n";
+
+// The output format selected by the --with-kmers, --binary and --unitigs flags. Exits with
+// an error message for combinations that make no sense.
+static inline OutputFormat parse_output_format(const CommandLine& args){
+    if(args.has("unitigs")){
+        if(args.has("with-kmers") || args.has("binary")){
+            cerr << "Error: --unitigs can not be combined with --with-kmers or --binary" << endl;
+            exit(1);
+        }
+        return OutputFormat::UNITIGS;
+    }
+    if(args.has("binary") && !args.has("with-kmers")){
+        cerr << "Error: --binary requires --with-kmers" << endl;
+        exit(1);
+    }
+    if(args.has("binary")) return OutputFormat::KMERS_BINARY;
+    if(args.has("with-kmers")) return OutputFormat::KMERS;
+    return OutputFormat::HANDLES;
+}
+
+template<typename sbwt_t>
+void write_counters_output(ostream& out, const sbwt_t& sbwt, const CounterTable& counters,
+                           const HandleBitmap& kmer_handles_found, OutputFormat format){
+    PhaseClock clock;
+    if(format == OutputFormat::HANDLES){
+        write_counters(out, counters, kmer_handles_found);
+    } else if(format == OutputFormat::UNITIGS){
+        write_unitigs(out, sbwt, counters, kmer_handles_found);
+    } else{
+        cerr << "Reconstructing the k-mers of the found handles" << endl;
+        PackedKmers P = extract_packed_kmers(sbwt, &kmer_handles_found);
+        if(format == OutputFormat::KMERS_BINARY) write_counters_with_kmers_binary(out, counters, kmer_handles_found, P);
+        else write_counters_with_kmers(out, counters, kmer_handles_found, P);
+    }
+    out.flush();
+    clock.lap(Phase::OUTPUT);
+}
@@ -0,0 +1,182 @@
+#pragma once
+
+#include "sbwt/SBWT.hh"
+#include "counters.hh"
+#include "gzip_input.hh"
+#include "hugepages.hh"
+#include "radix_sort.hh"
+#include "stats.hh"
+#include "work_queue.hh"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace sbwt;
+
+static const string DENSE_USAGE =
+    "  --dense                 Count each input file with --n-threads threads into one shared count per handle\n"
+    "  --dense-updates m       atomic: increment the shared counts directly (default), buffered: sort each\n"
+    "                          thread's handles and add runs of equal handles with one increment\n";
+
+enum class DenseUpdates{
+    ATOMIC,
+    BUFFERED,
+};
+
+static inline DenseUpdates parse_dense_updates(const string& mode){
+    if(mode == "atomic") return DenseUpdates::ATOMIC;
+    if(mode == "buffered") return DenseUpdates::BUFFERED;
+    cerr << "Error: --dense-updates must be atomic or buffered" << endl;
+    exit(1);
+}
+
+// Sequences read from a file, concatenated. Sequence i is bases[ends[i-1]..ends[i]).
+struct ReadBatch{
+    string bases;
+    vector<int64_t> ends;
+};
+
+// K-mer handle -> count. The counts are 64-bit so that the concurrent additions can never wrap
+// around before append_dense_counts clamps them to the range of a Counter.
+typedef vector<uint64_t, HugePageAllocator<uint64_t>> DenseCounts;
+
+// Counts the k-mers of one file into `counts` with n_threads threads. An uncompressed regular
+// file is split at record starts (see find_record_start) into one range per worker, and each
+// worker parses its own range. A gzipped file or a stream is parsed by a reader thread into
+// batches of sequences for the workers. The workers search the sequences and increment the
+// counts of the handles with relaxed atomic adds, which never lose an increment and need no
+// ordering. In BUFFERED mode a worker first collects the handles of `buffer_size` k-mers, radix
+// sorts them and adds each run of equal handles at once. That makes fewer atomic operations,
+// which helps when many threads hit the same frequent k-mers, and touches the array in order.
+// If color_stats is given, adds the statistics of the file to it.
+template<typename sbwt_t>
+void count_kmers_dense(const sbwt_t& sbwt, const string& filename, DenseCounts& counts, int64_t n_threads,
+                       DenseUpdates updates, int64_t buffer_size = 1 << 20, ColorStats* color_stats = nullptr){
+    ColorStats file_stats;
+    mutex stats_mutex;
+    bool split = !is_stream(filename) && !is_gzipped(filename);
+    int64_t file_size = split ? std::filesystem::file_size(filename) : 0;
+    WorkQueue<ReadBatch> queue(2 * n_threads);
+    const int64_t batch_bases = 1 << 20;
+
+    thread reader;
+    if(!split) reader = thread([&](){
+        PhaseClock clock;
+        ReadBatch batch;
+        auto on_length = [&](int64_t length){
+            file_stats.records++;
+            file_stats.bases += length;
+        };
+        for_each_record(filename, sbwt.get_k(), [](const char*, int64_t){}, [&](const char* seq, int64_t length){
+            batch.bases.append(seq, length);
+            batch.ends.push_back(batch.bases.size());
+            if(batch.bases.size() >= batch_bases){
+                clock.lap(Phase::PARSE);
+                queue.push(std::move(batch));
+                batch = ReadBatch();
+                clock.reset();
+            }
+        }, on_length);
+        clock.lap(Phase::PARSE);
+        if(batch.ends.size() > 0) queue.push(std::move(batch));
+        queue.close();
+    });
+
+    vector<thread> workers;
+    for(int64_t t = 0; t < n_threads; t++){
+        workers.emplace_back([&, t](){
+            PhaseClock clock;
+            ThreadStats& stats = instrumentation().local();
+            vector<int64_t> buffer, tmp;
+            int64_t records = 0, bases = 0, kmers_searched = 0, kmers_found = 0;
+
+            auto flush = [&](){
+                radix_sort_handles(buffer, tmp, counts.size() - 1);
+                for(int64_t i = 0; i < buffer.size();){
+                    int64_t j = i;
+                    while(j < buffer.size() && buffer[j] == buffer[i]) j++;
+                    std::atomic_ref<uint64_t>(counts[buffer[i]]).fetch_add(j - i, memory_order_relaxed);
+                    i = j;
+                }
+                buffer.clear();
+            };
+
+            auto count_sequence = [&](const char* seq, int64_t length){
+                vector<int64_t> handles = sbwt.streaming_search(seq, length);
+                clock.lap(Phase::SEARCH);
+
+                int64_t hits = 0;
+                for(int64_t handle : handles){
+                    if(handle == -1) continue;
+                    hits++;
+                    if(updates == DenseUpdates::ATOMIC) std::atomic_ref<uint64_t>(counts[handle]).fetch_add(1, memory_order_relaxed);
+                    else buffer.push_back(handle);
+                }
+                if(buffer.size() >= buffer_size) flush();
+                clock.lap(Phase::UPDATE);
+
+                ThreadStats::add(stats.kmers_searched, handles.size());
+                ThreadStats::add(stats.hits, hits);
+                ThreadStats::add(stats.misses, handles.size() - hits);
+                kmers_searched += handles.size();
+                kmers_found += hits;
+            };
+
+            if(split){
+                int64_t begin = find_record_start(filename, file_size * t / n_threads);
+                int64_t end = find_record_start(filename, file_size * (t + 1) / n_threads);
+                auto on_length = [&](int64_t length){
+                    records++;
+                    bases += length;
+                };
+                for_each_record(filename, sbwt.get_k(), [](const char*, int64_t){}, [&](const char* seq, int64_t length){
+                    clock.lap(Phase::PARSE);
+                    count_sequence(seq, length);
+                }, on_length, begin, end);
+                clock.lap(Phase::PARSE);
+            } else{
+                ReadBatch batch;
+                while(queue.pop(batch)){
+                    clock.reset();
+                    int64_t start = 0;
+                    for(int64_t end : batch.ends){
+                        count_sequence(batch.bases.data() + start, end - start);
+                        start = end;
+                    }
+                }
+            }
+            clock.reset();
+            flush();
+            clock.lap(Phase::UPDATE);
+
+            lock_guard<mutex> lock(stats_mutex);
+            file_stats.records += records;
+            file_stats.bases += bases;
+            file_stats.kmers_searched += kmers_searched;
+            file_stats.kmers_found += kmers_found;
+        });
+    }
+
+    if(!split) reader.join();
+    for(thread& t : workers) t.join();
+    if(color_stats != nullptr) color_stats->add(file_stats);
+}
+
+// Appends the nonzero dense counts as counters of the given color and resets them to zero.
+// Colors must be appended in increasing order.
+static inline void append_dense_counts(DenseCounts& counts, int32_t color, CounterTable& counters, HandleBitmap& kmer_handles_found){
+    PhaseClock clock;
+    for(int64_t handle = 0; handle < counts.size(); handle++){
+        if(counts[handle] == 0) continue;
+        Counter C = {.color = color, .count = (int32_t)min<uint64_t>(counts[handle], INT32_MAX)};
+        counters[handle].push_back(C);
+        kmer_handles_found[handle] = 1;
+        counts[handle] = 0;
+    }
+    clock.lap(Phase::UPDATE);
+}
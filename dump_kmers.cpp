@@ -1,94 +1,61 @@
 
 #include "sbwt/SBWT.hh"
 #include "sbwt/variants.hh"
+#include "cli.hh"
+#include "kmer_labels.hh"
+#include "load_sbwt.hh"
+#include "stats.hh"
 
 using namespace sbwt;
 
-typedef plain_matrix_sbwt_t sbwt_t;
-
-void dump_all_kmers_to_stdout(const sdsl::bit_vector& A_bits,
-                          const sdsl::bit_vector& C_bits, 
-                          const sdsl::bit_vector& G_bits, 
-                          const sdsl::bit_vector& T_bits,
-                          int64_t k){
-
-    int64_t n_nodes = A_bits.size();
-    vector<int64_t> C_array(4);
-
-    vector<char> last; // last[i] = incoming character to node i
-    last.push_back('$');
-
-    C_array[0] = last.size();
-    for(int64_t i = 0; i < n_nodes; i++) if(A_bits[i]) last.push_back('A');
-
-    C_array[1] = last.size();
-    for(int64_t i = 0; i < n_nodes; i++) if(C_bits[i]) last.push_back('C');
-
-    C_array[2] = last.size();
-    for(int64_t i = 0; i < n_nodes; i++) if(G_bits[i]) last.push_back('G');
-    
-    C_array[3] = last.size();
-    for(int64_t i = 0; i < n_nodes; i++) if(T_bits[i]) last.push_back('T');
-
-    if(last.size() != n_nodes){
-        cerr << "BUG " << last.size() << " " << n_nodes << endl;
-        exit(1);
-    }
-
-    string kmers_concat(n_nodes * k, '\0');
-
-    for(int64_t round = 0; round < k; round++){
-        cerr << "round " << round << "/" << k-1 << endl;
-        for(int64_t i = 0; i < n_nodes; i++){
-            int64_t pos = k-1-round;
-            kmers_concat[i*k + pos] = last[i];
-        }
-
-        // Propagate the labels one step forward in the graph
-        vector<char> propagated(n_nodes, '$');
-        int64_t A_ptr = C_array[0];
-        int64_t C_ptr = C_array[1];
-        int64_t G_ptr = C_array[2];
-        int64_t T_ptr = C_array[3];
-        for(int64_t i = 0; i < n_nodes; i++){
-            if(A_bits[i]) propagated[A_ptr++] = last[i];
-            if(C_bits[i]) propagated[C_ptr++] = last[i];
-            if(G_bits[i]) propagated[G_ptr++] = last[i];
-            if(T_bits[i]) propagated[T_ptr++] = last[i];
-        }
-        last = propagated;
-    }
-
-    for(int64_t i = 0; i < n_nodes; i++){
-        cout << kmers_concat.substr(i*k, k) << "\n";
+void dump_all_kmers_to_stdout(const PackedKmers& P, bool skip_dummies){
+    for(int64_t i = 0; i < P.size(); i++){
+        if(skip_dummies && P.is_dummy(i)) continue;
+        cout << P.to_string(i) << "\n";
     }
 }
 
 int main(int argc, char** argv){
 
-    string indexfile = argv[1];
-
-    throwing_ifstream in(indexfile, ios::binary);
-    string variant = load_string(in.stream); // read variant type
-    if(variant != "plain-matrix"){
-        cerr << "Error: this code only supports the plain matrix variant" << endl;
+    CommandLine args(argc, argv, {"binary", "skip-dummies", "perf"}, {"valid-handles", "progress"});
+    if(args.positional.size() != 1){
+        cerr << "Usage: " << argv[0] << " index.sbwt [--binary] [--skip-dummies] [--valid-handles file] [--progress seconds] [--perf]" << endl;
+        cerr << "  --binary               Write the k-mers as packed 2-bit words instead of text (see kmer_labels.hh)" << endl;
+        cerr << "  --skip-dummies         Omit the '$'-padded dummy nodes from the output" << endl;
+        cerr << "  --valid-handles file   Write the bit vector of non-dummy handles with rank support to this file" << endl;
+        cerr << "  --progress seconds     Print a progress line to stderr at this interval" << endl;
+        cerr << "  --perf                 Measure cycles, instructions, LLC and dTLB misses per phase" << endl;
         return 1;
     }
 
-    cerr << "Loading SBWT from " << indexfile << endl;
-    sbwt_t sbwt;
-    sbwt.load(in.stream);
+    if(args.has("progress")) instrumentation().start_progress(args.get_int("progress", 10));
+    if(args.has("perf")) instrumentation().enable_perf();
 
-    cerr << "SBWT loaded" << endl;
-    cerr << "Extracting k-mers..." << endl;
+    string indexfile = args.positional[0];
 
-    dump_all_kmers_to_stdout(
-        sbwt.get_subset_rank_structure().A_bits,
-        sbwt.get_subset_rank_structure().C_bits,
-        sbwt.get_subset_rank_structure().G_bits,
-        sbwt.get_subset_rank_structure().T_bits,
-        sbwt.get_k());
+    int ret = with_loaded_sbwt(indexfile, [&](const auto& sbwt){
+        cerr << "Extracting k-mers..." << endl;
+        PhaseClock clock;
+
+        PackedKmers P = extract_packed_kmers(sbwt);
+
+        if(args.has("valid-handles")){
+            throwing_ofstream out(args.get("valid-handles", ""), ios::binary);
+            write_valid_handles(out.stream, P);
+        }
+
+        if(args.has("binary")){
+            write_packed_kmers(cout, P, args.has("skip-dummies"));
+            cout.flush();
+        } else{
+            dump_all_kmers_to_stdout(P, args.has("skip-dummies"));
+        }
+        cout.flush();
+        clock.lap(Phase::OUTPUT);
+        return 0;
+    });
 
-    
+    instrumentation().report(cerr);
+    return ret;
 
 }
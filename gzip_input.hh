@@ -0,0 +1,304 @@
+#pragma once
+
+#include "seq_parser.hh"
+#include "work_queue.hh"
+#include <zlib.h>
+#ifdef COUNTERS_LIBDEFLATE
+#include <libdeflate.h>
+#endif
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+static const string DECOMPRESSION_USAGE =
+    "  --decompression-threads n  Threads that decompress each BGZF input in parallel (default: 4)\n";
+
+// The number of threads that decompress a BGZF file. Set once at startup.
+static inline int64_t& decompression_threads(){
+    static int64_t n = 4;
+    return n;
+}
+
+// True if the data starts like BGZF (blocked gzip, as written by bgzip and htslib): a gzip
+// member with a BC extra subfield that stores the size of the block
+static inline bool is_bgzf_header(const unsigned char* header, int64_t n){
+    return n >= 18 && header[0] == 0x1f && header[1] == 0x8b && header[2] == 8 && (header[3] & 4)
+        && header[12] == 'B' && header[13] == 'C' && header[14] == 2 && header[15] == 0;
+}
+
+// True if the file is BGZF
+static inline bool is_bgzf(const string& filename){
+    FILE* f = fopen(filename.c_str(), "rb");
+    if(f == nullptr) return false;
+    unsigned char header[18];
+    size_t n = fread(header, 1, 18, f);
+    fclose(f);
+    return is_bgzf_header(header, n);
+}
+
+// Plain gzip, inflated by a dedicated thread that stays a few buffers ahead of the parser.
+// Concatenated gzip members are read as one stream.
+class GzipInputStream : public InputStream{
+
+    WorkQueue<vector<char>> blocks;
+    vector<char> block;
+    int64_t block_pos = 0;
+    thread inflater;
+
+public:
+
+    // `filename` is used in error messages
+    GzipInputStream(unique_ptr<InputStream> source, const string& filename) : blocks(4){
+        inflater = thread([this, filename, source = std::move(source)](){
+            z_stream z;
+            memset(&z, 0, sizeof(z));
+            inflateInit2(&z, 15 + 16); // gzip header
+            vector<unsigned char> in(1 << 20);
+            const int64_t out_size = 4 << 20;
+            vector<char> out(out_size);
+            int64_t out_len = 0;
+            bool done = false;
+            while(!done){
+                if(z.avail_in == 0){
+                    z.avail_in = source->read((char*)in.data(), in.size());
+                    z.next_in = in.data();
+                    if(z.avail_in == 0){
+                        // The input ended inside a member, before its end and checksum
+                        cerr << "Error: truncated gzip file " << filename << endl;
+                        exit(1);
+                    }
+                }
+                z.next_out = (Bytef*)out.data() + out_len;
+                z.avail_out = out_size - out_len;
+                int ret = inflate(&z, Z_NO_FLUSH);
+                out_len = out_size - z.avail_out;
+                if(ret == Z_STREAM_END){
+                    // Another member may follow
+                    if(z.avail_in == 0){
+                        z.avail_in = source->read((char*)in.data(), in.size());
+                        z.next_in = in.data();
+                    }
+                    if(z.avail_in == 0) done = true;
+                    else inflateReset(&z);
+                } else if(ret != Z_OK && ret != Z_BUF_ERROR){
+                    cerr << "Error: " << filename << " is not a valid gzip file" << endl;
+                    exit(1);
+                }
+                if(out_len == out_size || done){
+                    out.resize(out_len);
+                    if(!blocks.push(std::move(out))) break; // The reader was closed early
+                    out = vector<char>(out_size);
+                    out_len = 0;
+                }
+            }
+            if(out_len > 0){
+                out.resize(out_len);
+                blocks.push(std::move(out));
+            }
+            inflateEnd(&z);
+            blocks.close();
+        });
+    }
+
+    int64_t read(char* dest, int64_t n) override{
+        while(block_pos == block.size()){
+            block_pos = 0;
+            if(!blocks.pop(block)){
+                block.clear();
+                return 0;
+            }
+        }
+        int64_t len = min<int64_t>(n, block.size() - block_pos);
+        memcpy(dest, block.data() + block_pos, len);
+        block_pos += len;
+        return len;
+    }
+
+    ~GzipInputStream(){
+        blocks.close();
+        inflater.join();
+    }
+
+};
+
+// BGZF consists of independent gzip blocks of at most 64 kB, each storing its compressed and
+// uncompressed size, so the blocks can be inflated in parallel. A reader thread cuts the file
+// into jobs of 64 blocks, a pool of threads inflates the jobs, and read() returns the jobs in
+// file order.
+class BgzfInputStream : public InputStream{
+
+    struct Job{
+        vector<unsigned char> compressed;
+        vector<int64_t> block_starts; // Offsets of the blocks' deflate data in `compressed`
+        vector<int64_t> block_lengths;
+        vector<uint32_t> block_sizes; // Uncompressed sizes
+        vector<char> output;
+        promise<void> done;
+    };
+
+    WorkQueue<shared_ptr<Job>> ordered; // All jobs, in file order
+    WorkQueue<shared_ptr<Job>> pending; // Jobs not yet taken by an inflater
+    thread reader;
+    vector<thread> inflaters;
+
+    shared_ptr<Job> current;
+    int64_t current_pos = 0;
+
+    static void inflate_job(Job& job, const string& filename){
+        int64_t total = 0;
+        for(uint32_t size : job.block_sizes) total += size;
+        job.output.resize(total);
+        int64_t out_pos = 0;
+        for(int64_t b = 0; b < job.block_starts.size(); b++){
+            const unsigned char* in = job.compressed.data() + job.block_starts[b];
+            bool ok;
+#ifdef COUNTERS_LIBDEFLATE
+            thread_local libdeflate_decompressor* d = libdeflate_alloc_decompressor();
+            size_t actual = 0;
+            ok = libdeflate_deflate_decompress(d, in, job.block_lengths[b], job.output.data() + out_pos,
+                                               job.block_sizes[b], &actual) == LIBDEFLATE_SUCCESS
+                 && actual == job.block_sizes[b];
+#else
+            z_stream z;
+            memset(&z, 0, sizeof(z));
+            inflateInit2(&z, -15); // Raw deflate
+            z.next_in = (Bytef*)in;
+            z.avail_in = job.block_lengths[b];
+            z.next_out = (Bytef*)job.output.data() + out_pos;
+            z.avail_out = job.block_sizes[b];
+            ok = inflate(&z, Z_FINISH) == Z_STREAM_END && z.avail_out == 0;
+            inflateEnd(&z);
+#endif
+            if(!ok){
+                cerr << "Error: corrupted BGZF block in " << filename << endl;
+                exit(1);
+            }
+            out_pos += job.block_sizes[b];
+        }
+    }
+
+public:
+
+    // `filename` is used in error messages
+    BgzfInputStream(unique_ptr<InputStream> source, const string& filename, int64_t n_threads)
+        : ordered(2 * n_threads + 2), pending(2 * n_threads + 2){
+
+        reader = thread([this, filename, source = std::move(source)](){
+            const int64_t blocks_per_job = 64;
+            auto job = make_shared<Job>();
+            while(true){
+                unsigned char header[12];
+                if(read_fully(*source, (char*)header, 12) != 12) break;
+                int64_t xlen = header[10] | (header[11] << 8);
+                vector<unsigned char> extra(xlen);
+                if(header[0] != 0x1f || header[1] != 0x8b || read_fully(*source, (char*)extra.data(), xlen) != xlen){
+                    cerr << "Error: " << filename << " is not a valid BGZF file" << endl;
+                    exit(1);
+                }
+                int64_t block_size = -1; // BSIZE + 1
+                for(int64_t i = 0; i + 4 <= xlen; i += 4 + (extra[i+2] | (extra[i+3] << 8))){
+                    if(extra[i] == 'B' && extra[i+1] == 'C' && extra[i+2] == 2 && i + 6 <= xlen) block_size = (extra[i+4] | (extra[i+5] << 8)) + 1;
+                }
+                int64_t rest = block_size - 12 - xlen; // Deflate data and the 8-byte trailer
+                if(block_size == -1 || rest < 8){
+                    cerr << "Error: " << filename << " is not a valid BGZF file" << endl;
+                    exit(1);
+                }
+                int64_t start = job->compressed.size();
+                job->compressed.resize(start + rest);
+                if(read_fully(*source, (char*)job->compressed.data() + start, rest) != rest){
+                    cerr << "Error: truncated BGZF file " << filename << endl;
+                    exit(1);
+                }
+                const unsigned char* trailer = job->compressed.data() + start + rest - 8;
+                uint32_t isize = trailer[4] | (trailer[5] << 8) | (trailer[6] << 16) | ((uint32_t)trailer[7] << 24);
+                if(isize == 0){
+                    job->compressed.resize(start); // Empty block, e.g. the end-of-file marker
+                    continue;
+                }
+                job->block_starts.push_back(start);
+                job->block_lengths.push_back(rest - 8);
+                job->block_sizes.push_back(isize);
+
+                if(job->block_starts.size() == blocks_per_job){
+                    if(!ordered.push(job)) break; // The reader was closed early
+                    pending.push(job);
+                    job = make_shared<Job>();
+                }
+            }
+            if(job->block_starts.size() > 0 && ordered.push(job)) pending.push(job);
+            ordered.close();
+            pending.close();
+        });
+
+        for(int64_t t = 0; t < n_threads; t++){
+            inflaters.emplace_back([this, filename](){
+                shared_ptr<Job> job;
+                while(pending.pop(job)){
+                    inflate_job(*job, filename);
+                    job->done.set_value();
+                }
+            });
+        }
+    }
+
+    int64_t read(char* dest, int64_t n) override{
+        while(!current || current_pos == current->output.size()){
+            if(!ordered.pop(current)){
+                current.reset();
+                return 0;
+            }
+            current->done.get_future().wait();
+            current_pos = 0;
+        }
+        int64_t len = min<int64_t>(n, current->output.size() - current_pos);
+        memcpy(dest, current->output.data() + current_pos, len);
+        current_pos += len;
+        return len;
+    }
+
+    ~BgzfInputStream(){
+        ordered.close();
+        reader.join();
+        pending.close();
+        for(thread& t : inflaters) t.join();
+    }
+
+};
+
+// Opens a FASTA or FASTQ file for reading, decompressing it on other threads if it is gzipped
+static inline unique_ptr<SeqParser> open_sequence_file(const string& filename){
+    if(is_bgzf(filename)) return make_unique<SeqParser>(make_unique<BgzfInputStream>(make_unique<FileInputStream>(filename), filename, decompression_threads()));
+    if(is_gzipped(filename)) return make_unique<SeqParser>(make_unique<GzipInputStream>(make_unique<FileInputStream>(filename), filename));
+    return make_unique<SeqParser>(filename);
+}
+
+// Like open_sequence_file, for standard input ("-") or a named pipe. The start of the stream
+// is read to tell the format and then passed on to the parser.
+static inline unique_ptr<SeqParser> open_sequence_stream(const string& filename){
+    unique_ptr<InputStream> input = make_unique<FileInputStream>(filename);
+    string head(18, '\0');
+    head.resize(read_fully(*input, head.data(), head.size()));
+    bool bgzf = is_bgzf_header((const unsigned char*)head.data(), head.size());
+    bool gzipped = is_gzip_header((const unsigned char*)head.data(), head.size());
+    input = make_unique<PrefixedInputStream>(std::move(head), std::move(input));
+    if(bgzf) return make_unique<SeqParser>(make_unique<BgzfInputStream>(std::move(input), filename, decompression_threads()));
+    if(gzipped) return make_unique<SeqParser>(make_unique<GzipInputStream>(std::move(input), filename));
+    return make_unique<SeqParser>(std::move(input));
+}
+
+// Like open_sequence_file, for the contents of a file already in memory
+static inline unique_ptr<SeqParser> open_sequence_buffer(const char* data, int64_t size, const string& filename){
+    auto input = make_unique<MemoryInputStream>(data, size);
+    if(is_bgzf_header((const unsigned char*)data, size)) return make_unique<SeqParser>(make_unique<BgzfInputStream>(std::move(input), filename, decompression_threads()));
+    if(is_gzip_header((const unsigned char*)data, size)) return make_unique<SeqParser>(make_unique<GzipInputStream>(std::move(input), filename));
+    return make_unique<SeqParser>(std::move(input));
+}
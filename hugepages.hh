@@ -0,0 +1,145 @@
+#pragma once
+
+#include "sbwt/SBWT.hh"
+#include <sys/mman.h>
+#include <cerrno>
+#include <concepts>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <new>
+#include <string>
+
+using namespace sbwt;
+
+// Arrays indexed by k-mer handle are accessed at random over the whole handle space, so with
+// 4 kB pages almost every access is a TLB miss. These helpers back large allocations with 2 MB
+// pages instead.
+enum class HugePages{
+    OFF, // Regular pages
+    TRANSPARENT, // 2 MB aligned mappings with madvise(MADV_HUGEPAGE)
+    EXPLICIT, // mmap(MAP_HUGETLB) from the reserved pool (vm.nr_hugepages), or TRANSPARENT if it is empty
+};
+
+static constexpr size_t HUGE_PAGE_SIZE = 2 << 20;
+
+static const string HUGE_PAGES_USAGE =
+    "  --huge-pages m  Back the index and the counter arrays with 2 MB pages: off (default), transparent or explicit\n";
+
+// The mode used by all allocations. Set it once at startup, before the index and the counters
+// are allocated.
+static inline HugePages& huge_pages_mode(){
+    static HugePages mode = HugePages::OFF;
+    return mode;
+}
+
+static inline HugePages parse_huge_pages(const string& mode){
+    if(mode == "off") return HugePages::OFF;
+    if(mode == "transparent") return HugePages::TRANSPARENT;
+    if(mode == "explicit") return HugePages::EXPLICIT;
+    cerr << "Error: --huge-pages must be off, transparent or explicit" << endl;
+    exit(1);
+}
+
+static inline size_t round_up_to_huge_pages(size_t bytes){
+    return (bytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+}
+
+// Asks the kernel to back the 2 MB aligned interior of an existing allocation with
+// transparent huge pages. Pages that are already mapped are collapsed in the background.
+static inline void advise_huge_pages(const void* ptr, size_t bytes){
+    uintptr_t begin = ((uintptr_t)ptr + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+    uintptr_t end = ((uintptr_t)ptr + bytes) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+    if(begin < end) madvise((void*)begin, end - begin, MADV_HUGEPAGE);
+}
+
+// Allocations of at least one huge page are always mmapped, whatever the mode, so that
+// huge_page_free can tell them apart from malloc'd ones by the size alone.
+static inline void* huge_page_alloc(size_t bytes){
+    if(bytes < HUGE_PAGE_SIZE){
+        void* ptr = malloc(bytes);
+        if(ptr == nullptr) throw std::bad_alloc();
+        return ptr;
+    }
+
+    size_t length = round_up_to_huge_pages(bytes);
+    if(huge_pages_mode() == HugePages::EXPLICIT){
+        void* ptr = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if(ptr != MAP_FAILED) return ptr;
+        static bool warned = false;
+        if(!warned) cerr << "Warning: no explicit huge pages available (" << strerror(errno) << "), using transparent huge pages" << endl;
+        warned = true;
+    }
+
+    // Map one extra huge page and trim the ends so that the mapping is 2 MB aligned
+    char* raw = (char*)mmap(nullptr, length + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(raw == MAP_FAILED) throw std::bad_alloc();
+    char* ptr = (char*)(((uintptr_t)raw + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE);
+    if(ptr > raw) munmap(raw, ptr - raw);
+    munmap(ptr + length, raw + HUGE_PAGE_SIZE - ptr);
+    if(huge_pages_mode() != HugePages::OFF) madvise(ptr, length, MADV_HUGEPAGE);
+    return ptr;
+}
+
+static inline void huge_page_free(void* ptr, size_t bytes){
+    if(bytes < HUGE_PAGE_SIZE) free(ptr);
+    else munmap(ptr, round_up_to_huge_pages(bytes));
+}
+
+// Standard allocator on top of huge_page_alloc, for the vectors indexed by handle
+template<typename T>
+struct HugePageAllocator{
+
+    typedef T value_type;
+
+    HugePageAllocator() = default;
+    template<typename U> HugePageAllocator(const HugePageAllocator<U>&){}
+
+    T* allocate(size_t n){
+        return (T*)huge_page_alloc(n * sizeof(T));
+    }
+
+    void deallocate(T* ptr, size_t n){
+        huge_page_free(ptr, n * sizeof(T));
+    }
+
+    template<typename U> bool operator==(const HugePageAllocator<U>&) const{ return true; }
+    template<typename U> bool operator!=(const HugePageAllocator<U>&) const{ return false; }
+
+};
+
+// In explicit mode, makes sdsl allocate the bit vectors of the index that is loaded next from
+// a pool of explicit huge pages sized by the index file. Does nothing in the other modes.
+// sdsl serves every later sdsl allocation from the pool too, and throws when it runs out, so
+// the pool holds all n_copies of the index (see load_index_replicas) plus one index worth of
+// headroom for the bit vectors built from it, such as the dummy mask and the unitig starts,
+// which have one bit per node.
+static inline void reserve_huge_pages_for_index(const string& indexfile, int64_t n_copies = 1){
+    if(huge_pages_mode() != HugePages::EXPLICIT) return;
+    size_t bytes = round_up_to_huge_pages(std::filesystem::file_size(indexfile) * (n_copies + 1) * 1.1 + HUGE_PAGE_SIZE);
+    try{
+        sdsl::memory_manager::use_hugepages(bytes);
+    } catch(const std::exception& e){
+        cerr << "Warning: could not reserve " << bytes / HUGE_PAGE_SIZE << " explicit huge pages for the index ("
+             << e.what() << "), the index uses transparent huge pages" << endl;
+    }
+}
+
+// Advises transparent huge pages for the bit vectors that streaming_search reads at random:
+// the subset rank bit vectors of the matrix variants and the suffix group starts. Other
+// variants are left as they are. Does nothing if huge pages are off.
+template<typename sbwt_t>
+void advise_huge_pages_for_index(const sbwt_t& sbwt){
+    if(huge_pages_mode() == HugePages::OFF) return;
+    auto advise = [](const sdsl::bit_vector& bv){ advise_huge_pages(bv.data(), (bv.bit_size() + 63) / 64 * 8); };
+    const auto& subset_rank = sbwt.get_subset_rank_structure();
+    if constexpr(requires { { subset_rank.A_bits } -> std::same_as<const sdsl::bit_vector&>; }){
+        advise(subset_rank.A_bits);
+        advise(subset_rank.C_bits);
+        advise(subset_rank.G_bits);
+        advise(subset_rank.T_bits);
+    }
+    advise(sbwt.get_streaming_support());
+}
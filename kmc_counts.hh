@@ -0,0 +1,161 @@
+#pragma once
+
+#include "sbwt/SBWT.hh"
+#include "counters.hh"
+#include "kmer_labels.hh"
+#include "stats.hh"
+#include "gzip_input.hh"
+#include "kmc_file.h"
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace sbwt;
+
+// Deletes a database made by run_kmc and its directory
+static inline void remove_kmc_database(const string& db){
+    remove((db + ".kmc_pre").c_str());
+    remove((db + ".kmc_suf").c_str());
+    rmdir(db.substr(0, db.rfind('/')).c_str());
+}
+
+// True if the sequence file is FASTQ, judging by its first byte after decompression
+static inline bool is_fastq_file(const string& filename){
+    unique_ptr<InputStream> input = make_unique<FileInputStream>(filename);
+    if(is_gzipped(filename)) input = make_unique<GzipInputStream>(std::move(input), filename);
+    char first = 0;
+    return input->read(&first, 1) == 1 && first == '@';
+}
+
+// Runs a program with the given arguments, without a shell, with its standard output sent to
+// standard error. Returns true if it exited with status 0.
+static inline bool run_program(const vector<string>& args){
+    vector<char*> argv;
+    for(const string& arg : args) argv.push_back(const_cast<char*>(arg.c_str()));
+    argv.push_back(nullptr);
+    pid_t pid = fork();
+    if(pid < 0) return false;
+    if(pid == 0){
+        dup2(2, 1);
+        execvp(argv[0], argv.data());
+        cerr << "Error: could not run " << args[0] << endl;
+        _exit(127);
+    }
+    int status = 0;
+    while(waitpid(pid, &status, 0) < 0) if(errno != EINTR) return false;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// Counts the k-mers of a single sequence file with the KMC binary (non-canonical, like the SBWT
+// construction) and returns the path prefix of the resulting KMC database. The database is
+// written to a new directory under temp_dir, so that concurrent runs and existing databases
+// are never overwritten. Delete it with remove_kmc_database.
+static inline string run_kmc(const string& kmc_binary, const string& filename, int64_t k, int64_t n_threads,
+                             int64_t ram_gigas, int64_t min_abundance, int64_t max_abundance, const string& temp_dir){
+    string format = is_fastq_file(filename) ? "-fq" : "-fm";
+
+    string dir = temp_dir + "/kmc-counts-XXXXXX";
+    if(mkdtemp(dir.data()) == nullptr){
+        cerr << "Error: could not create a temporary directory in " << temp_dir << endl;
+        exit(1);
+    }
+    string db = dir + "/counts";
+    vector<string> args = {kmc_binary, "-v", "-b", "-k" + to_string(k), "-t" + to_string(n_threads),
+        "-m" + to_string(ram_gigas), "-ci" + to_string(min_abundance), "-cx" + to_string(max_abundance),
+        "-cs4294967295", format, filename, db, dir};
+    cerr << "Running";
+    for(const string& arg : args) cerr << " " << arg;
+    cerr << endl;
+    if(!run_program(args)){
+        remove_kmc_database(db);
+        cerr << "Error: KMC failed" << endl;
+        exit(1);
+    }
+    return db;
+}
+
+// The 2-bit colexicographic key of a k-mer with k <= 32: the last character is the most
+// significant, so that comparing keys compares the reversed k-mers.
+static inline uint64_t colex_key(const string& kmer){
+    uint64_t key = 0;
+    for(int64_t j = kmer.size() - 1; j >= 0; j--) key = (key << 2) | nucleotide_to_2bit(kmer[j]);
+    return key;
+}
+
+static inline uint64_t colex_key(const uint64_t* packed, int64_t k){
+    uint64_t key = 0;
+    for(int64_t j = k - 1; j >= 0; j--) key = (key << 2) | ((packed[0] >> (62 - 2*j)) & 3);
+    return key;
+}
+
+// Assigns the counts of a KMC database to the SBWT handles as the counters of the given color.
+// The SBWT handles are in colexicographic order of the k-mers, so the database is sorted by
+// colex_key and merged with the non-dummy handles in one pass, without searching any k-mer.
+// K-mers of the database that are not in the index are ignored.
+template<typename sbwt_t>
+void count_kmers_from_kmc_database(const sbwt_t& sbwt, const string& kmc_db, int32_t color,
+                                   CounterTable& counters, HandleBitmap& kmer_handles_found){
+    int64_t k = sbwt.get_k();
+    if(k > 32){
+        cerr << "Error: counting from a KMC database supports only k <= 32" << endl;
+        exit(1);
+    }
+
+    CKMCFile database;
+    if(!database.OpenForListing(kmc_db)){
+        cerr << "Error: could not open KMC database " << kmc_db << endl;
+        exit(1);
+    }
+
+    uint32 kmer_length, mode, counter_size, lut_prefix_length, signature_len, min_count;
+    uint64 max_count, total_kmers;
+    database.Info(kmer_length, mode, counter_size, lut_prefix_length, signature_len, min_count, max_count, total_kmers);
+    if(kmer_length != k){
+        cerr << "Error: KMC database has k = " << kmer_length << " but the index has k = " << k << endl;
+        exit(1);
+    }
+
+    PhaseClock clock;
+    cerr << "Reading " << total_kmers << " k-mers from KMC database " << kmc_db << endl;
+    vector<pair<uint64_t, uint32_t>> kmc_counts; // (colex key, count)
+    kmc_counts.reserve(total_kmers);
+    CKmerAPI kmer(kmer_length);
+    uint64 count;
+    string kmer_string;
+    while(database.ReadNextKmer(kmer, count)){
+        kmer.to_string(kmer_string);
+        kmc_counts.push_back({colex_key(kmer_string), min<uint64>(count, INT32_MAX)});
+    }
+    database.Close();
+    std::sort(kmc_counts.begin(), kmc_counts.end());
+    clock.lap(Phase::PARSE);
+
+    cerr << "Merging KMC counts with the SBWT handles" << endl;
+    PackedKmers P = extract_packed_kmers(sbwt);
+    int64_t j = 0, n_mapped = 0;
+    for(int64_t handle = 0; handle < P.size() && j < kmc_counts.size(); handle++){
+        if(P.is_dummy(handle)) continue;
+        uint64_t key = colex_key(P.get(handle), k);
+        while(j < kmc_counts.size() && kmc_counts[j].first < key) j++;
+        if(j < kmc_counts.size() && kmc_counts[j].first == key){
+            Counter C = {.color = color, .count = (int32_t)kmc_counts[j].second};
+            counters[handle].push_back(C);
+            kmer_handles_found[handle] = 1;
+            n_mapped++;
+            j++;
+        }
+    }
+
+    clock.lap(Phase::UPDATE);
+
+    if(n_mapped != kmc_counts.size())
+        cerr << "Warning: " << kmc_counts.size() - n_mapped << " k-mers of the KMC database are not in the index" << endl;
+}
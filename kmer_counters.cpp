@@ -0,0 +1,196 @@
+#include "sbwt/SBWT.hh"
+#include "sbwt/variants.hh"
+#include "cli.hh"
+#include "counters.hh"
+#include "counters_output.hh"
+#ifdef COUNTERS_KMC_API // Set by the build if the KMC core library was found
+#include "kmc_counts.hh"
+#endif
+#include "stats.hh"
+
+using namespace sbwt;
+
+typedef plain_matrix_sbwt_t sbwt_t;
+
+static void print_run_usage(const char* program){
+    cerr << "Usage: " << program << " run listfile.txt --kmer-length k [options]" << endl;
+    cerr << "Builds the SBWT of the files in listfile.txt in memory and counts the k-mers of every" << endl;
+    cerr << "file against it, one color per file, without writing the index to disk." << endl;
+    cerr << "  --kmer-length k      The k-mer length" << endl;
+    cerr << "  --n-threads n        Number of threads for the construction (default: 1)" << endl;
+    cerr << "  --ram-gigas n        RAM budget of the construction in gigabytes (default: 2)" << endl;
+    cerr << "  --temp-dir dir       Location for temporary construction files (default: .)" << endl;
+    cerr << "  --min-abundance n    Discard k-mers occurring fewer than n times (default: 1)" << endl;
+    cerr << "  --max-abundance n    Discard k-mers occurring more than n times (default: 1000000000)" << endl;
+    cerr << "  --save-index file    Also write the index to this file" << endl;
+    cerr << "  --kmc-counts         Single input file only: count the input again with KMC and map its counts" << endl;
+    cerr << "                       onto the index instead of searching the input against it (see count-kmc)" << endl;
+    cerr << "  --kmc-binary path    The KMC executable used with --kmc-counts (default: kmc)" << endl;
+    cerr << OUTPUT_FORMAT_USAGE;
+    cerr << COLOR_METADATA_USAGE;
+    cerr << BATCH_SIZE_USAGE;
+    cerr << MIN_QUALITY_USAGE;
+    cerr << DECOMPRESSION_USAGE;
+    cerr << READ_AHEAD_USAGE;
+    cerr << HUGE_PAGES_USAGE;
+}
+
+static void print_count_kmc_usage(const char* program){
+    cerr << "Usage: " << program << " count-kmc index.sbwt kmc_database [options]" << endl;
+    cerr << "Maps the counts of a KMC database (non-canonical, same k as the index) onto the handles of" << endl;
+    cerr << "a plain-matrix index as color 0, by one sorted merge instead of a search of every k-mer." << endl;
+    cerr << OUTPUT_FORMAT_USAGE;
+    cerr << HUGE_PAGES_USAGE;
+}
+
+// count-kmc and --kmc-counts read KMC databases through the KMC core library
+static const string NO_KMC_API_ERROR =
+    "Error: this build has no KMC database support, because SBWT/KMC/bin/libkmc_core.a was not found";
+
+static int count_kmc(const CommandLine& args, const char* program){
+    if(args.positional.size() != 3){
+        print_count_kmc_usage(program);
+        return 1;
+    }
+#ifndef COUNTERS_KMC_API
+    cerr << NO_KMC_API_ERROR << endl;
+    return 1;
+#else
+
+    OutputFormat format = parse_output_format(args);
+    if(args.has("progress")) instrumentation().start_progress(args.get_int("progress", 10));
+    if(args.has("perf")) instrumentation().enable_perf();
+    if(args.has("huge-pages")) huge_pages_mode() = parse_huge_pages(args.get("huge-pages", "off"));
+    if(args.has("decompression-threads")) decompression_threads() = args.get_int("decompression-threads", 4);
+    string indexfile = args.positional[1];
+
+    throwing_ifstream in(indexfile, ios::binary);
+    string variant = load_string(in.stream); // read variant type
+    if(variant != "plain-matrix"){
+        cerr << "Error: this code only supports the plain matrix variant" << endl;
+        return 1;
+    }
+
+    cerr << "Loading SBWT from " << indexfile << endl;
+    reserve_huge_pages_for_index(indexfile);
+    PhaseClock clock;
+    sbwt_t sbwt;
+    sbwt.load(in.stream);
+    advise_huge_pages_for_index(sbwt);
+    clock.lap(Phase::INDEX);
+
+    cerr << "SBWT loaded" << endl;
+
+    int64_t sbwt_length = sbwt.number_of_subsets();
+    CounterTable counters(sbwt_length); // K-mer handle -> list of counters
+    HandleBitmap kmer_handles_found(sbwt_length); // Bit vector that marks which k-mer handles have at least 1 counter
+
+    count_kmers_from_kmc_database(sbwt, args.positional[2], 0, counters, kmer_handles_found);
+
+    write_counters_output(cout, sbwt, counters, kmer_handles_found, format);
+    instrumentation().report(cerr);
+    return 0;
+#endif
+}
+
+static int run(const CommandLine& args, const char* program){
+    if(args.positional.size() != 2 || !args.has("kmer-length")){
+        print_run_usage(program);
+        return 1;
+    }
+
+    OutputFormat format = parse_output_format(args);
+    if(args.has("progress")) instrumentation().start_progress(args.get_int("progress", 10));
+    if(args.has("perf")) instrumentation().enable_perf();
+    if(args.has("huge-pages")) huge_pages_mode() = parse_huge_pages(args.get("huge-pages", "off"));
+    if(args.has("decompression-threads")) decompression_threads() = args.get_int("decompression-threads", 4);
+    if(args.has("min-quality")) min_base_quality() = parse_min_quality(args.get_int("min-quality", 0));
+#ifndef COUNTERS_KMC_API
+    if(args.has("kmc-counts")){
+        cerr << NO_KMC_API_ERROR << endl;
+        return 1;
+    }
+#endif
+    if(args.has("kmc-counts") && args.has("min-quality")){
+        cerr << "Error: --min-quality can not be combined with --kmc-counts" << endl;
+        return 1;
+    }
+    vector<string> filenames = read_list_file(args.positional[1]);
+    for(const string& filename : filenames){
+        if(is_stream(filename)){
+            cerr << "Error: " << filename << " is a stream, but run reads its inputs twice: once to build the index and once to count" << endl;
+            return 1;
+        }
+    }
+
+    sbwt_t::BuildConfig config;
+    config.input_files = filenames;
+    config.k = args.get_int("kmer-length", 0);
+    config.n_threads = args.get_int("n-threads", 1);
+    config.ram_gigas = args.get_int("ram-gigas", 2);
+    config.temp_dir = args.get("temp-dir", ".");
+    config.min_abundance = args.get_int("min-abundance", 1);
+    config.max_abundance = args.get_int("max-abundance", 1000000000);
+
+    cerr << "Building SBWT of " << filenames.size() << " files with k = " << config.k << endl;
+    PhaseClock clock;
+    sbwt_t sbwt(config);
+    advise_huge_pages_for_index(sbwt);
+    clock.lap(Phase::INDEX);
+    cerr << "SBWT built" << endl;
+
+    if(args.has("save-index")){
+        throwing_ofstream out(args.get("save-index", ""), ios::binary);
+        serialize_string("plain-matrix", out.stream);
+        sbwt.serialize(out.stream);
+    }
+
+    int64_t sbwt_length = sbwt.number_of_subsets();
+
+    CounterTable counters(sbwt_length); // K-mer handle -> list of counters
+
+    HandleBitmap kmer_handles_found(sbwt_length); // Bit vector that marks which k-mer handles have at least 1 counter
+    ColorMetadata metadata; // Not collected from a KMC database
+
+    if(args.has("kmc-counts")){
+        if(filenames.size() != 1){
+            cerr << "Error: --kmc-counts supports only a single input file" << endl;
+            return 1;
+        }
+#ifdef COUNTERS_KMC_API
+        string kmc_db = run_kmc(args.get("kmc-binary", "kmc"), filenames[0], config.k, config.n_threads,
+                                config.ram_gigas, config.min_abundance, config.max_abundance, config.temp_dir);
+        count_kmers_from_kmc_database(sbwt, kmc_db, 0, counters, kmer_handles_found);
+        remove_kmc_database(kmc_db);
+#endif
+    } else{
+        ReadBackend backend = parse_read_backend(args.get("read-backend", "io_uring"));
+        for_each_input_file(filenames, args.get_int("read-ahead", 8), backend, [&](const InputFile& file, int32_t color){
+            count_kmers_in_file(sbwt, file, color, counters, kmer_handles_found, args.get_int("batch-size", 0), &metadata);
+        });
+    }
+    if(args.has("color-metadata")){
+        ColorNames names;
+        for(const string& filename : filenames) names.add(filename);
+        metadata.write(args.get("color-metadata", ""), names);
+    }
+
+    write_counters_output(cout, sbwt, counters, kmer_handles_found, format);
+    instrumentation().report(cerr);
+    return 0;
+}
+
+int main(int argc, char** argv){
+
+    CommandLine args(argc, argv, {"with-kmers", "binary", "unitigs", "kmc-counts", "perf"},
+                     {"kmer-length", "n-threads", "ram-gigas", "temp-dir", "min-abundance", "max-abundance", "save-index",
+                      "kmc-binary", "progress", "huge-pages", "color-metadata", "batch-size", "min-quality",
+                      "decompression-threads", "read-ahead", "read-backend"});
+    string command = args.positional.size() > 0 ? args.positional[0] : "";
+    if(command == "run") return run(args, argv[0]);
+    if(command == "count-kmc") return count_kmc(args, argv[0]);
+
+    cerr << "Usage: " << argv[0] << " <command> [options]" << endl;
+    cerr << "Commands: run, count-kmc. Run a command without arguments for its options." << endl;
+    return 1;
+}
@@ -0,0 +1,259 @@
+#pragma once
+
+#include "sbwt/SBWT.hh"
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+using namespace sbwt;
+
+// Calls f(i) for each set bit i of bv in increasing order, using the fastest way to decode
+// the given bit vector type.
+template<typename bitvector_t, typename F>
+void for_each_set_bit(const bitvector_t& bv, F f){
+    int64_t n = bv.size();
+    if constexpr(std::is_same_v<bitvector_t, sdsl::bit_vector>){
+        const uint64_t* data = bv.data();
+        for(int64_t w = 0; w * 64 < n; w++){
+            uint64_t word = data[w];
+            if((w+1) * 64 > n) word &= (~uint64_t(0)) >> ((w+1) * 64 - n); // Bits past the end
+            while(word != 0){
+                f(w * 64 + __builtin_ctzll(word));
+                word &= word - 1;
+            }
+        }
+    } else if constexpr(std::is_same_v<bitvector_t, sdsl::sd_vector<>>){
+        // Elias-Fano: walk the ones with select instead of decoding every position
+        typename bitvector_t::rank_1_type rs(&bv);
+        typename bitvector_t::select_1_type ss(&bv);
+        int64_t n_ones = rs(n);
+        for(int64_t j = 1; j <= n_ones; j++) f(ss(j));
+    } else if constexpr(requires { bv.get_int(0, 64); }){
+        // Compressed vectors such as rrr_vector decode whole blocks with get_int
+        for(int64_t i = 0; i < n; i += 64){
+            int64_t len = min<int64_t>(64, n - i);
+            uint64_t word = bv.get_int(i, len);
+            while(word != 0){
+                f(i + __builtin_ctzll(word));
+                word &= word - 1;
+            }
+        }
+    } else{
+        for(int64_t i = 0; i < n; i++) if(bv[i]) f(i);
+    }
+}
+
+// The positions of the subset rank structure whose subset contains a character, as one bit
+// vector per character. The matrix variants store exactly these bit vectors, so they are
+// iterated in place. All other variants only answer rank queries, so their bit vectors are
+// decoded once with rank(i+1, c) - rank(i, c) into plain bit vectors.
+template<typename subset_rank_t>
+class SubsetBits{
+
+    const subset_rank_t& subset_rank;
+    int64_t n_nodes;
+    vector<sdsl::bit_vector> decoded; // Empty for the matrix variants
+
+    static constexpr bool is_matrix = requires(const subset_rank_t& sr){ sr.A_bits; sr.C_bits; sr.G_bits; sr.T_bits; };
+
+public:
+
+    SubsetBits(const subset_rank_t& subset_rank, int64_t n_nodes) : subset_rank(subset_rank), n_nodes(n_nodes){
+        if constexpr(!is_matrix){
+            for(char c : {'A', 'C', 'G', 'T'}){
+                sdsl::bit_vector bits(n_nodes, 0);
+                int64_t prev_rank = 0;
+                for(int64_t i = 0; i < n_nodes; i++){
+                    int64_t r = subset_rank.rank(i+1, c);
+                    if(r != prev_rank) bits[i] = 1;
+                    prev_rank = r;
+                }
+                decoded.push_back(std::move(bits));
+            }
+        }
+    }
+
+    // Calls f(i) for each node i whose subset contains character number c_idx (0..3 = ACGT),
+    // in increasing order of i.
+    template<typename F>
+    void for_each(int64_t c_idx, F f) const{
+        if constexpr(is_matrix){
+            switch(c_idx){
+                case 0: for_each_set_bit(subset_rank.A_bits, f); break;
+                case 1: for_each_set_bit(subset_rank.C_bits, f); break;
+                case 2: for_each_set_bit(subset_rank.G_bits, f); break;
+                case 3: for_each_set_bit(subset_rank.T_bits, f); break;
+            }
+        } else for_each_set_bit(decoded[c_idx], f);
+    }
+
+};
+
+// Reconstructs the k-mer labels of all SBWT nodes one character position at a time, from the
+// last position to the first. For each position pos = k-1, k-2, ..., 0, calls
+// callback(pos, labels) where labels[i] is the character at position pos of node i.
+// Dummy nodes are padded with '$' from the left.
+template<typename subset_rank_t, typename callback_t>
+void propagate_labels(const subset_rank_t& subset_rank, int64_t n_nodes, int64_t k, callback_t callback){
+
+    SubsetBits<subset_rank_t> bits(subset_rank, n_nodes);
+    vector<int64_t> C_array(4);
+
+    vector<char> last; // last[i] = incoming character to node i
+    last.push_back('$');
+
+    for(int64_t c = 0; c < 4; c++){
+        C_array[c] = last.size();
+        bits.for_each(c, [&](int64_t){ last.push_back("ACGT"[c]); });
+    }
+
+    if(last.size() != n_nodes){
+        cerr << "BUG " << last.size() << " " << n_nodes << endl;
+        exit(1);
+    }
+
+    vector<char> propagated(n_nodes);
+    for(int64_t round = 0; round < k; round++){
+        cerr << "round " << round << "/" << k-1 << endl;
+        callback(k-1-round, (const vector<char>&)last);
+        if(round == k-1) break;
+
+        // Propagate the labels one step forward in the graph. The targets of the edges
+        // labeled with c are consecutive starting from C_array[c].
+        std::fill(propagated.begin(), propagated.end(), '$');
+        for(int64_t c = 0; c < 4; c++){
+            int64_t ptr = C_array[c];
+            bits.for_each(c, [&](int64_t i){ propagated[ptr++] = last[i]; });
+        }
+        last.swap(propagated);
+    }
+}
+
+// K-mer labels packed with two bits per nucleotide (A=0, C=1, G=2, T=3). Each k-mer takes
+// words_per_kmer = ceil(k/32) words, character j is in word j/32 at bits 62-2*(j%32) and
+// 63-2*(j%32), i.e. the first character is the most significant. The '$' characters of
+// dummy nodes are stored as A. Dummy nodes are padded from the left, so the label of record r
+// starts with dollar_depth[r] '$' characters.
+//
+// The records are the labels of the extracted handles in increasing handle order. When all
+// handles are extracted, record r is the label of handle r.
+struct PackedKmers{
+
+    int64_t k = 0;
+    int64_t words_per_kmer = 0;
+    vector<uint64_t> words; // words_per_kmer words for each record
+    vector<uint8_t> dollar_depth; // Number of '$' characters in the label of each record
+    sdsl::bit_vector dummy_mask; // dummy_mask[i] = 1 iff node i is a dummy, for all nodes
+
+    int64_t size() const{
+        return dollar_depth.size();
+    }
+
+    const uint64_t* get(int64_t record) const{
+        return words.data() + record * words_per_kmer;
+    }
+
+    string to_string(int64_t record) const{
+        string kmer(k, '$');
+        const uint64_t* w = get(record);
+        for(int64_t j = dollar_depth[record]; j < k; j++)
+            kmer[j] = "ACGT"[(w[j/32] >> (62 - 2*(j%32))) & 3];
+        return kmer;
+    }
+
+    bool is_dummy(int64_t record) const{
+        return dollar_depth[record] > 0;
+    }
+
+};
+
+static inline uint64_t nucleotide_to_2bit(char c){
+    switch(c){
+        case 'C': return 1;
+        case 'G': return 2;
+        case 'T': return 3;
+        default: return 0; // A and $
+    }
+}
+
+// Extracts the labels of the handles marked in `handles`, or of all handles if it is null.
+// Only the selected labels are stored, but the propagation still runs over all nodes.
+template<typename sbwt_t, typename handle_set_t = vector<bool>>
+PackedKmers extract_packed_kmers(const sbwt_t& sbwt, const handle_set_t* handles = nullptr){
+    int64_t n_nodes = sbwt.number_of_subsets();
+
+    int64_t n_records = n_nodes;
+    if(handles != nullptr) n_records = std::count(handles->begin(), handles->end(), true);
+
+    PackedKmers P;
+    P.k = sbwt.get_k();
+    P.words_per_kmer = (P.k + 31) / 32;
+    P.words.resize(n_records * P.words_per_kmer, 0);
+    P.dollar_depth.resize(n_records, 0);
+    P.dummy_mask = sdsl::bit_vector(n_nodes, 0);
+
+    propagate_labels(sbwt.get_subset_rank_structure(), n_nodes, P.k,
+        [&](int64_t pos, const vector<char>& labels){
+            int64_t word = pos / 32;
+            int64_t shift = 62 - 2*(pos % 32);
+            int64_t record = 0;
+            for(int64_t i = 0; i < n_nodes; i++){
+                if(labels[i] == '$') P.dummy_mask[i] = 1;
+                if(handles != nullptr && !(*handles)[i]) continue;
+                P.words[record * P.words_per_kmer + word] |= nucleotide_to_2bit(labels[i]) << shift;
+                P.dollar_depth[record] += (labels[i] == '$');
+                record++;
+            }
+        });
+
+    return P;
+}
+
+// Binary k-mer file: the magic string below, then the 64-bit fields k, words_per_kmer,
+// n_nodes and n_records, then the dummy mask as ceil(n_nodes/64) words (bit i%64 of word i/64
+// is set iff node i is a dummy), then n_records packed k-mers of words_per_kmer words each.
+// All integers are little-endian.
+static const string PACKED_KMERS_MAGIC = "SBWTKMR1";
+
+static inline void write_u64(ostream& out, uint64_t x){
+    out.write((const char*)&x, sizeof(x));
+}
+
+static inline void write_packed_kmers_header(ostream& out, int64_t k, int64_t words_per_kmer,
+                                             const sdsl::bit_vector& dummy_mask, int64_t n_records){
+    out.write(PACKED_KMERS_MAGIC.data(), PACKED_KMERS_MAGIC.size());
+    write_u64(out, k);
+    write_u64(out, words_per_kmer);
+    write_u64(out, dummy_mask.size());
+    write_u64(out, n_records);
+    for(int64_t i = 0; i < (int64_t)dummy_mask.size(); i += 64)
+        write_u64(out, dummy_mask.get_int(i, min<int64_t>(64, dummy_mask.size() - i)));
+}
+
+static inline void write_packed_kmers(ostream& out, const PackedKmers& P, bool skip_dummies){
+    if(!skip_dummies){
+        write_packed_kmers_header(out, P.k, P.words_per_kmer, P.dummy_mask, P.size());
+        out.write((const char*)P.words.data(), P.words.size() * sizeof(uint64_t));
+        return;
+    }
+
+    int64_t n_valid = 0;
+    for(int64_t i = 0; i < P.size(); i++) n_valid += !P.is_dummy(i);
+    write_packed_kmers_header(out, P.k, P.words_per_kmer, P.dummy_mask, n_valid);
+    for(int64_t i = 0; i < P.size(); i++){
+        if(!P.is_dummy(i)) out.write((const char*)P.get(i), P.words_per_kmer * sizeof(uint64_t));
+    }
+}
+
+// Writes the handles of the non-dummy nodes as an sdsl bit vector followed by its
+// rank_support_v5. The k-mer of handle h is record rank(h) of a dump with dummies skipped.
+static inline void write_valid_handles(ostream& out, const PackedKmers& P){
+    sdsl::bit_vector valid(P.dummy_mask.size(), 0);
+    for(int64_t i = 0; i < (int64_t)valid.size(); i++) valid[i] = !P.dummy_mask[i];
+    sdsl::rank_support_v5<> valid_rs(&valid);
+    valid.serialize(out);
+    valid_rs.serialize(out);
+}
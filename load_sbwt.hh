@@ -0,0 +1,39 @@
+#pragma once
+
+#include "sbwt/SBWT.hh"
+#include "sbwt/variants.hh"
+#include "stats.hh"
+#include <string>
+
+using namespace sbwt;
+
+// Loads the SBWT in indexfile, whatever its variant, and returns f(sbwt) where sbwt is the
+// loaded index with its concrete type. f is instantiated once for every variant.
+template<typename F>
+int with_loaded_sbwt(const string& indexfile, F f){
+    throwing_ifstream in(indexfile, ios::binary);
+    string variant = load_string(in.stream); // read variant type
+
+    auto load_and_run = [&](auto sbwt) -> int {
+        cerr << "Loading SBWT (" << variant << ") from " << indexfile << endl;
+        PhaseClock clock;
+        sbwt.load(in.stream);
+        clock.lap(Phase::INDEX);
+        cerr << "SBWT loaded" << endl;
+        return f(sbwt);
+    };
+
+    if(variant == "plain-matrix") return load_and_run(plain_matrix_sbwt_t());
+    if(variant == "rrr-matrix") return load_and_run(rrr_matrix_sbwt_t());
+    if(variant == "mef-matrix") return load_and_run(mef_matrix_sbwt_t());
+    if(variant == "plain-split") return load_and_run(plain_split_sbwt_t());
+    if(variant == "rrr-split") return load_and_run(rrr_split_sbwt_t());
+    if(variant == "mef-split") return load_and_run(mef_split_sbwt_t());
+    if(variant == "plain-concat") return load_and_run(plain_concat_sbwt_t());
+    if(variant == "mef-concat") return load_and_run(mef_concat_sbwt_t());
+    if(variant == "plain-subsetwt") return load_and_run(plain_sswt_sbwt_t());
+    if(variant == "rrr-subsetwt") return load_and_run(rrr_sswt_sbwt_t());
+
+    cerr << "Error: unknown SBWT variant " << variant << endl;
+    return 1;
+}
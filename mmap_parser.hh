@@ -0,0 +1,162 @@
+#pragma once
+
+#include "seq_parser.hh"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// A read-only memory mapping of a whole file, advised for sequential reading
+class MappedFile{
+
+public:
+
+    const char* data = nullptr;
+    int64_t size = 0;
+
+    MappedFile(const string& filename){
+        int fd = open(filename.c_str(), O_RDONLY);
+        struct stat st;
+        if(fd == -1 || fstat(fd, &st) != 0){
+            cerr << "Error: could not open " << filename << endl;
+            exit(1);
+        }
+        size = st.st_size;
+        if(size > 0){
+            void* ptr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(ptr == MAP_FAILED){
+                cerr << "Error: could not map " << filename << " to memory" << endl;
+                exit(1);
+            }
+            madvise(ptr, size, MADV_SEQUENTIAL);
+            data = (const char*)ptr;
+        }
+        close(fd);
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile(){
+        if(data != nullptr) munmap((void*)data, size);
+    }
+
+};
+
+// Parses an uncompressed FASTA or FASTQ file in place from a memory mapping, or from a copy
+// of the file already in memory, without copying the sequences. Like SeqParser, it reads the records that start in the byte range
+// [begin, end), where begin is a record start. Each record is passed to the caller as the
+// pieces of sequence to search: FASTQ sequences and single-line FASTA sequences are one piece
+// pointing into the mapping. For multi-line FASTA, every line is its own piece. The k-mers
+// that cross a line break are passed as a short stitched piece: the last k-1 bases before the
+// break followed by the first k-1 bases after it. Together the pieces contain every k-mer of
+// the record exactly once. Line scanning uses memchr, which glibc vectorizes with SSE2/AVX2.
+// Frame lines (see FRAME_MARKER) end the previous record and are collected in `frames`.
+class MmapSeqParser{
+
+    unique_ptr<MappedFile> mapping;
+    const char* data;
+    int64_t size;
+    int64_t k;
+    int64_t pos; // Start of the next line
+    int64_t end;
+    bool fastq;
+    string tail; // The last k-1 bases of the current FASTA record
+    string stitch;
+
+    // The length of the line starting at p without the line break, and moves p past the line
+    int64_t next_line(int64_t& p){
+        const char* start = data + p;
+        const char* newline = (const char*)memchr(start, '\n', size - p);
+        int64_t len = newline == nullptr ? size - p : newline - start;
+        p += len + 1;
+        if(len > 0 && start[len-1] == '\r') len--;
+        return len;
+    }
+
+public:
+
+    int64_t record_length = 0; // Sequence length of the last record
+    const char* quality = nullptr; // Quality line of the last FASTQ record, if as long as the sequence
+    vector<string> frames; // Names of the frame lines before the last record, or at the end. Cleared by the caller.
+
+    // Parses the contents of a file in memory, which must outlive the parser
+    MmapSeqParser(const char* data, int64_t size, int64_t k, int64_t begin = 0, int64_t end = INT64_MAX)
+        : data(data), size(size), k(k), pos(begin), end(min(end, size)){
+        int64_t first = leading_frames_length(data, size);
+        fastq = first < size && data[first] == '@';
+    }
+
+    MmapSeqParser(const string& filename, int64_t k, int64_t begin = 0, int64_t end = INT64_MAX)
+        : MmapSeqParser(nullptr, 0, k, begin, end){
+        mapping = make_unique<MappedFile>(filename);
+        data = mapping->data;
+        size = mapping->size;
+        this->end = min(end, size);
+        int64_t first = leading_frames_length(data, size);
+        fastq = first < size && data[first] == '@';
+    }
+
+    // Calls on_header(ptr, length) with the header line of the next record, without the
+    // marker, and then f(ptr, length) for each piece of its sequence. Returns false when the
+    // range has no more records.
+    template<typename H, typename F>
+    bool next_record(H on_header, F f){
+        char marker = fastq ? '@' : '>';
+        while(pos < end && data[pos] != marker){
+            int64_t start = pos;
+            int64_t len = next_line(pos);
+            if(is_frame_line(data + start, len)) frames.emplace_back(data + start + FRAME_MARKER.size(), len - FRAME_MARKER.size());
+        }
+        if(pos >= end) return false;
+        int64_t header_start = pos;
+        int64_t header_len = next_line(pos);
+        on_header(data + header_start + 1, header_len - 1);
+        record_length = 0;
+
+        if(fastq){
+            int64_t start = pos;
+            int64_t len = pos < size ? next_line(pos) : 0;
+            if(pos < size) next_line(pos); // +
+            int64_t quality_start = pos;
+            int64_t quality_len = pos < size ? next_line(pos) : 0;
+            quality = quality_len == len ? data + quality_start : nullptr;
+            if(len > 0) f(data + start, len);
+            record_length = len;
+            return true;
+        }
+
+        tail.clear();
+        while(pos < size && data[pos] != '>' && !is_frame_line(data + pos, size - pos)){
+            int64_t start = pos;
+            int64_t len = next_line(pos);
+            if(len == 0) continue;
+            record_length += len;
+            const char* line = data + start;
+            if(tail.size() > 0){
+                stitch = tail;
+                stitch.append(line, min(len, k - 1));
+                if(stitch.size() >= k) f(stitch.data(), (int64_t)stitch.size());
+            }
+            if(len >= k) f(line, len);
+
+            // Keep the last k-1 bases of the record so far
+            if(len >= k - 1) tail.assign(line + len - (k - 1), k - 1);
+            else{
+                tail.append(line, len);
+                if(tail.size() > k - 1) tail.erase(0, tail.size() - (k - 1));
+            }
+        }
+        return true;
+    }
+
+};
@@ -5,3 +5,6 @@ set -xue
 
 # Build the counters
 ./counters index.sbwt in_file_list.txt >multi_genome_color_matrix.txt
+
+# Alternatively, build the index in memory and count in one process without writing index.sbwt
+# ./kmer_counters run in_file_list.txt --kmer-length 31 --n-threads 8 --ram-gigas 10 --temp-dir temp >multi_genome_color_matrix.txt
@@ -1,20 +1,60 @@
 
 #include "sbwt/SBWT.hh"
 #include "sbwt/variants.hh"
+#include "cli.hh"
+#include "colors.hh"
+#include "counters.hh"
+#include "counters_output.hh"
+#include "numa.hh"
+#include "stats.hh"
 #include <iostream>
 #include <fstream>
 #include <string>
 using namespace sbwt;
 typedef plain_matrix_sbwt_t sbwt_t;
 
-struct Counter{
-    int32_t color;
-    int32_t count;
-};
-
 int main(int argc, char** argv){
 
-    string indexfile = argv[1];
+    CommandLine args(argc, argv, {"with-kmers", "binary", "unitigs", "perf", "numa", "numa-replicate-index"},
+                     {"progress", "huge-pages", "color-by", "color-regex", "color-names", "color-metadata", "groups",
+                      "batch-size", "min-quality", "decompression-threads", "read-ahead", "read-backend",
+                      "n-threads", "numa-updaters", "chunk-size"});
+    if(args.positional.size() < 2){
+        cerr << "Usage: " << argv[0] << " index.sbwt listfile.txt [listfile2.txt ...] [--with-kmers [--binary] | --unitigs] [--progress seconds] [--perf] [--huge-pages mode] [--color-by mode] [--groups file.tsv] [--numa ...]" << endl;
+        cerr << OUTPUT_FORMAT_USAGE;
+        cerr << COLOR_BY_USAGE;
+        cerr << COLOR_METADATA_USAGE;
+        cerr << STREAM_USAGE;
+        cerr << BATCH_SIZE_USAGE;
+        cerr << MIN_QUALITY_USAGE;
+        cerr << DECOMPRESSION_USAGE;
+        cerr << READ_AHEAD_USAGE;
+        cerr << HUGE_PAGES_USAGE;
+        cerr << NUMA_USAGE;
+        return 1;
+    }
+
+    OutputFormat format = parse_output_format(args);
+    ColorBy color_by = parse_color_by(args.get("color-by", "file"));
+    if(color_by == ColorBy::REGEX && !args.has("color-regex")){
+        cerr << "Error: --color-by regex needs --color-regex" << endl;
+        return 1;
+    }
+    if(color_by != ColorBy::FILE && args.has("groups")){
+        cerr << "Error: --groups needs --color-by file" << endl;
+        return 1;
+    }
+    if(color_by != ColorBy::FILE && args.has("numa")){
+        cerr << "Error: --numa colors by file only" << endl;
+        return 1;
+    }
+    if(args.has("progress")) instrumentation().start_progress(args.get_int("progress", 10));
+    if(args.has("perf")) instrumentation().enable_perf();
+    if(args.has("huge-pages")) huge_pages_mode() = parse_huge_pages(args.get("huge-pages", "off"));
+    if(args.has("decompression-threads")) decompression_threads() = args.get_int("decompression-threads", 4);
+    if(args.has("min-quality")) min_base_quality() = parse_min_quality(args.get_int("min-quality", 0));
+
+    string indexfile = args.positional[0];
 
     throwing_ifstream in(indexfile, ios::binary);
     string variant = load_string(in.stream); // read variant type
@@ -23,53 +63,72 @@ int main(int argc, char** argv){
         return 1;
     }
 
+    NumaTopology topology = NumaTopology::detect();
+    if(args.has("numa")) topology.pin_thread(0); // The index is loaded on the first node
+
     cerr << "Loading SBWT from " << indexfile << endl;
+    bool replicate = args.has("numa") && args.has("numa-replicate-index");
+    reserve_huge_pages_for_index(indexfile, replicate ? topology.n_nodes() : 1);
+    PhaseClock clock;
     sbwt_t sbwt;
     sbwt.load(in.stream);
+    advise_huge_pages_for_index(sbwt);
+    clock.lap(Phase::INDEX);
 
     cerr << "SBWT loaded" << endl;
 
+    vector<unique_ptr<sbwt_t>> replicas;
+    if(replicate) replicas = load_index_replicas<sbwt_t>(indexfile, topology);
+
     int64_t sbwt_length = sbwt.number_of_subsets();
 
-    vector<vector<Counter>> counters(sbwt_length); // K-mer handle -> list of counters
+    CounterTable counters(sbwt_length); // K-mer handle -> list of counters
 
-    vector<bool> kmer_handles_found(sbwt_length); // Bit vector that marks which k-mer handles have at least 1 counter
+    HandleBitmap kmer_handles_found(sbwt_length); // Bit vector that marks which k-mer handles have at least 1 counter
 
 
     // Ali Edit:
 
-    string text_filename = argv[2]; // list of the fasta files
-    
-    std::ifstream file(text_filename);
-    string line;
-    int32_t color=0;
-
-    while (std::getline(file, line)) { // read the file line by line
-        string filename= line;
-        seq_io::Reader<> reader(filename);
-        
-        while(true){
-            int64_t length = reader.get_next_read_to_buffer();
-            if(length == 0) break; // All sequences have been read
-
-            const char* seq = reader.read_buf; // The DNA sequence
-
-            // Search all k-mers of seq
-            vector<int64_t> handles = sbwt.streaming_search(seq, length);
-
-            for(int64_t handle : handles){
-                if(handle == -1) continue; // This k-mer does not exist in the index
-                if(counters[handle].size() == 0 || counters[handle].back().color != color){
-                    // No counter yet for this k-mer and this color
-                    Counter C = {.color = color, .count = 0}; // Create a counter
-                    counters[handle].push_back(C);
-                    kmer_handles_found[handle] = 1;
-                }
-                counters[handle].back().count++; // Add to the count of this color in this k-mer
-            }
+    // The lists of the fasta files, concatenated
+    vector<string> filenames;
+    for(int64_t i = 1; i < args.positional.size(); i++){
+        vector<string> list = read_list_file(args.positional[i]);
+        filenames.insert(filenames.end(), list.begin(), list.end());
+    }
+    unordered_map<string, string> file_groups;
+    if(args.has("groups")) file_groups = read_groups_file(args.get("groups", ""));
+    ColorAssigner color_assigner(color_by, args.get("color-regex", ""), file_groups);
+    ColorMetadata metadata; // Collected while counting, written if --color-metadata is given
+
+    if(args.has("numa")){
+        vector<int32_t> colors;
+        for(const string& filename : filenames) colors.push_back(color_assigner.start_file(filename));
+        int64_t updaters_per_node = args.get_int("numa-updaters", 1);
+        // By default the search threads take the CPUs that the updaters leave free
+        int64_t default_search_threads = max<int64_t>(1, topology.n_cpus() - topology.n_nodes() * updaters_per_node);
+        NumaConfig config = {.n_search_threads = args.get_int("n-threads", default_search_threads),
+                             .updaters_per_node = updaters_per_node};
+        config.chunk_size = args.get_int("chunk-size", config.chunk_size);
+        if(args.get_int("batch-size", 0) > 0){
+            config.batch_size = args.get_int("batch-size", 0);
+            config.sort_batches = true;
         }
-        color++;
+        count_kmers_numa(sbwt, replicas, topology, config, filenames, colors, counters, kmer_handles_found, &metadata);
+    } else{
+        // Without --numa the counting runs on this thread, so there is nothing for the work
+        // stealing scheduler to balance. The counter lists are not synchronized, and colors by
+        // record and frame lines are assigned in read order, which a parallel run would change.
+        // The next files of the list are read into memory while the current one is counted
+        ReadBackend backend = parse_read_backend(args.get("read-backend", "io_uring"));
+        for_each_input_file(filenames, args.get_int("read-ahead", 8), backend, [&](const InputFile& file, int64_t){
+            color_assigner.start_file(file.filename);
+            auto on_frame = [&](const string& name){ color_assigner.start_frame(name); };
+            auto color_of_record = [&](const char* header, int64_t length){ return color_assigner.color_of_record(header, length); };
+            count_kmers_in_records(sbwt, file, on_frame, color_of_record, counters, kmer_handles_found, args.get_int("batch-size", 0), &metadata);
+        });
     }
+    if(args.has("color-names")) color_assigner.write_names(args.get("color-names", ""));
+    if(args.has("color-metadata")) metadata.write(args.get("color-metadata", ""), color_assigner.names);
     
     // // Arguments 2..(argc-1) are sequence files from which we want to compute the k-mer counts
     // for(int64_t i = 2; i < argc; i++){
@@ -98,13 +157,7 @@ int main(int argc, char** argv){
     //     }
     // }
 
-    for(int64_t i = 0; i < counters.size(); i++){
-        if(kmer_handles_found[i]){
-            cout << i;
-            for(Counter C : counters[i]){
-                cout << " (" << C.color << ": " << C.count << ")";
-            }
-            cout << "\n";
-        }
-    }
+    write_counters_output(cout, sbwt, counters, kmer_handles_found, format);
+
+    instrumentation().report(cerr);
 }
@@ -0,0 +1,129 @@
+#pragma once
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include <cstdint>
+#include <string>
+
+using namespace std;
+
+// Vectorized checks over DNA sequences, 16 bytes at a time with SSE2 and one byte at a time
+// elsewhere
+
+static inline bool is_lowercase_base(char c){
+    return c >= 'a' && c <= 'z';
+}
+
+static inline bool is_valid_base(char c){
+    return c == 'A' || c == 'C' || c == 'G' || c == 'T';
+}
+
+// True if any of the n bytes is a lowercase letter
+static inline bool has_lowercase(const char* s, int64_t n){
+    int64_t i = 0;
+#ifdef __SSE2__
+    const __m128i before_a = _mm_set1_epi8('a' - 1), after_z = _mm_set1_epi8('z' + 1);
+    for(; i + 16 <= n; i += 16){
+        __m128i v = _mm_loadu_si128((const __m128i*)(s + i));
+        __m128i lower = _mm_and_si128(_mm_cmpgt_epi8(v, before_a), _mm_cmplt_epi8(v, after_z));
+        if(_mm_movemask_epi8(lower) != 0) return true;
+    }
+#endif
+    for(; i < n; i++) if(is_lowercase_base(s[i])) return true;
+    return false;
+}
+
+// Converts lowercase letters to uppercase in place
+static inline void to_uppercase(char* s, int64_t n){
+    int64_t i = 0;
+#ifdef __SSE2__
+    const __m128i before_a = _mm_set1_epi8('a' - 1), after_z = _mm_set1_epi8('z' + 1), case_bit = _mm_set1_epi8(0x20);
+    for(; i + 16 <= n; i += 16){
+        __m128i v = _mm_loadu_si128((const __m128i*)(s + i));
+        __m128i lower = _mm_and_si128(_mm_cmpgt_epi8(v, before_a), _mm_cmplt_epi8(v, after_z));
+        _mm_storeu_si128((__m128i*)(s + i), _mm_sub_epi8(v, _mm_and_si128(lower, case_bit)));
+    }
+#endif
+    for(; i < n; i++) if(is_lowercase_base(s[i])) s[i] -= 0x20;
+}
+
+// The length of the prefix of s that consists of A, C, G and T (valid = true), or of other
+// characters (valid = false)
+static inline int64_t base_run_length(const char* s, int64_t n, bool valid){
+    int64_t i = 0;
+#ifdef __SSE2__
+    const __m128i A = _mm_set1_epi8('A'), C = _mm_set1_epi8('C'), G = _mm_set1_epi8('G'), T = _mm_set1_epi8('T');
+    for(; i + 16 <= n; i += 16){
+        __m128i v = _mm_loadu_si128((const __m128i*)(s + i));
+        __m128i ok = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, A), _mm_cmpeq_epi8(v, C)),
+                                  _mm_or_si128(_mm_cmpeq_epi8(v, G), _mm_cmpeq_epi8(v, T)));
+        uint32_t stop = _mm_movemask_epi8(ok) ^ (valid ? 0xFFFF : 0); // Bits of the bytes that end the run
+        if(stop != 0) return i + __builtin_ctz(stop);
+    }
+#endif
+    for(; i < n; i++) if(is_valid_base(s[i]) != valid) return i;
+    return n;
+}
+
+// The index of the first of the n quality characters that is below min_quality, or n if
+// there is none
+static inline int64_t first_low_quality(const char* quality, int64_t n, char min_quality){
+    int64_t i = 0;
+#ifdef __SSE2__
+    const __m128i threshold = _mm_set1_epi8(min_quality);
+    for(; i + 16 <= n; i += 16){
+        __m128i v = _mm_loadu_si128((const __m128i*)(quality + i));
+        uint32_t low = _mm_movemask_epi8(_mm_cmplt_epi8(v, threshold));
+        if(low != 0) return i + __builtin_ctz(low);
+    }
+#endif
+    for(; i < n; i++) if(quality[i] < min_quality) return i;
+    return n;
+}
+
+// Replaces the bases whose quality character is below min_quality with N, in place
+static inline void mask_low_quality(char* seq, const char* quality, int64_t n, char min_quality){
+    int64_t i = 0;
+#ifdef __SSE2__
+    const __m128i threshold = _mm_set1_epi8(min_quality), N = _mm_set1_epi8('N');
+    for(; i + 16 <= n; i += 16){
+        __m128i v = _mm_loadu_si128((const __m128i*)(seq + i));
+        __m128i low = _mm_cmplt_epi8(_mm_loadu_si128((const __m128i*)(quality + i)), threshold);
+        _mm_storeu_si128((__m128i*)(seq + i), _mm_or_si128(_mm_and_si128(low, N), _mm_andnot_si128(low, v)));
+    }
+#endif
+    for(; i < n; i++) if(quality[i] < min_quality) seq[i] = 'N';
+}
+
+// The sequence with the bases below min_quality (a Phred+33 character) replaced by N, so
+// that they break the runs of for_each_base_run. Returns seq itself if no base is below the
+// threshold, which one vectorized scan of the quality line tells, and otherwise the masked
+// copy in `buffer`.
+static inline const char* mask_low_quality_bases(const char* seq, const char* quality, int64_t length, char min_quality, string& buffer){
+    int64_t first = first_low_quality(quality, length, min_quality);
+    if(first == length) return seq;
+    buffer.assign(seq, length);
+    mask_low_quality(buffer.data() + first, quality + first, length - first, min_quality);
+    return buffer.data();
+}
+
+// Calls f(ptr, length) on each maximal run of at least k bases A, C, G or T in the sequence,
+// after converting soft-masked lowercase bases to uppercase. Runs shorter than k have no
+// k-mers, so N and other IUPAC codes never reach the index search. A sequence with
+// lowercase bases is converted in `buffer`, otherwise the runs point into the sequence.
+template<typename F>
+void for_each_base_run(const char* seq, int64_t length, int64_t k, string& buffer, F f){
+    if(has_lowercase(seq, length)){
+        buffer.assign(seq, length);
+        to_uppercase(buffer.data(), length);
+        seq = buffer.data();
+    }
+    int64_t i = 0;
+    while(i < length){
+        int64_t run = base_run_length(seq + i, length - i, true);
+        if(run >= k) f(seq + i, run);
+        i += run;
+        i += base_run_length(seq + i, length - i, false);
+    }
+}
@@ -0,0 +1,288 @@
+#pragma once
+
+#include "sbwt/SBWT.hh"
+#include "counters.hh"
+#include "radix_sort.hh"
+#include "scheduler.hh"
+#include "gzip_input.hh"
+#include "seq_parser.hh"
+#include "stats.hh"
+#include "work_queue.hh"
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace sbwt;
+
+static const string NUMA_USAGE =
+    "  --numa                  Count with one thread per CPU, with the counters partitioned over the NUMA nodes\n"
+    "  --n-threads n           Number of search threads with --numa (default: the CPUs left by the updaters)\n"
+    "  --numa-updaters n       Counter update threads per NUMA node (default: 1)\n"
+    "  --numa-replicate-index  Load a copy of the index on every NUMA node\n"
+    "  --chunk-size bytes      With --numa, split uncompressed files larger than this for load balancing (default: 64 MB)\n";
+
+// "0-3,8,10-11" -> {0, 1, 2, 3, 8, 10, 11}
+static inline vector<int> parse_cpu_list(const string& list){
+    vector<int> cpus;
+    int64_t i = 0;
+    while(i < list.size()){
+        int64_t end = list.find(',', i);
+        if(end == string::npos) end = list.size();
+        string range = list.substr(i, end - i);
+        int64_t dash = range.find('-');
+        if(range.size() > 0 && range[0] != '\n'){
+            int first = stoi(range.substr(0, dash));
+            int last = dash == string::npos ? first : stoi(range.substr(dash + 1));
+            for(int cpu = first; cpu <= last; cpu++) cpus.push_back(cpu);
+        }
+        i = end + 1;
+    }
+    return cpus;
+}
+
+// The NUMA nodes that have CPUs, from /sys/devices/system/node. Machines without that
+// directory are one node with all CPUs.
+struct NumaTopology{
+
+    vector<int> node_ids; // Kernel node numbers
+    vector<vector<int>> node_cpus; // CPUs of each node
+
+    int64_t n_nodes() const{
+        return node_ids.size();
+    }
+
+    int64_t n_cpus() const{
+        int64_t n = 0;
+        for(const auto& cpus : node_cpus) n += cpus.size();
+        return n;
+    }
+
+    static NumaTopology detect(){
+        NumaTopology T;
+        const string sysfs = "/sys/devices/system/node";
+        if(std::filesystem::is_directory(sysfs)){
+            for(const auto& entry : std::filesystem::directory_iterator(sysfs)){
+                string name = entry.path().filename();
+                if(name.size() <= 4 || name.substr(0, 4) != "node" || !isdigit(name[4])) continue;
+                ifstream in(entry.path() / "cpulist");
+                string list;
+                getline(in, list);
+                vector<int> cpus = parse_cpu_list(list);
+                if(cpus.empty()) continue; // Memory-only node
+                T.node_ids.push_back(stoi(name.substr(4)));
+                T.node_cpus.push_back(cpus);
+            }
+        }
+        if(T.node_ids.empty()){
+            T.node_ids.push_back(0);
+            T.node_cpus.push_back({});
+            for(int cpu = 0; cpu < std::thread::hardware_concurrency(); cpu++) T.node_cpus[0].push_back(cpu);
+        }
+
+        // Sort by node number
+        vector<int64_t> order(T.node_ids.size());
+        for(int64_t i = 0; i < order.size(); i++) order[i] = i;
+        std::sort(order.begin(), order.end(), [&](int64_t a, int64_t b){ return T.node_ids[a] < T.node_ids[b]; });
+        NumaTopology sorted;
+        for(int64_t i : order){
+            sorted.node_ids.push_back(T.node_ids[i]);
+            sorted.node_cpus.push_back(T.node_cpus[i]);
+        }
+        return sorted;
+    }
+
+    // Restricts the calling thread to the CPUs of the given node (an index to node_ids). Its
+    // memory is then allocated on that node by the default first-touch policy.
+    void pin_thread(int64_t node) const{
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for(int cpu : node_cpus[node]) CPU_SET(cpu, &set);
+        if(sched_setaffinity(0, sizeof(set), &set) != 0)
+            cerr << "Warning: could not pin a thread to NUMA node " << node_ids[node] << endl;
+    }
+
+    // Moves the pages inside [ptr, ptr + bytes) to the given node and keeps them there
+    void bind_memory(const void* ptr, size_t bytes, int64_t node) const{
+        int64_t page = sysconf(_SC_PAGESIZE);
+        uintptr_t begin = ((uintptr_t)ptr + page - 1) / page * page;
+        uintptr_t end = ((uintptr_t)ptr + bytes) / page * page;
+        if(begin >= end) return;
+        vector<unsigned long> mask(node_ids[node] / 64 + 1, 0);
+        mask[node_ids[node] / 64] |= 1UL << (node_ids[node] % 64);
+        // The kernel reads maxnode - 1 bits of the mask, so pass one more than its size
+        syscall(SYS_mbind, begin, end - begin, MPOL_BIND, mask.data(), mask.size() * 64 + 1, MPOL_MF_MOVE);
+    }
+
+};
+
+struct NumaConfig{
+    int64_t n_search_threads;
+    int64_t updaters_per_node;
+    int64_t batch_size = 1 << 16; // Handles per batch sent to an updater
+    bool sort_batches = false; // Updaters radix sort each batch and apply it in handle order
+    int64_t chunk_size = 64 << 20; // Uncompressed files larger than this are split for the search threads
+};
+
+// Loads a copy of the index for every node except node 0, each in a thread pinned to its node
+// so that the copy is allocated there. Node 0 uses `sbwt`, which the caller has loaded on it.
+template<typename sbwt_t>
+vector<unique_ptr<sbwt_t>> load_index_replicas(const string& indexfile, const NumaTopology& topology){
+    vector<unique_ptr<sbwt_t>> replicas(topology.n_nodes());
+    vector<thread> threads;
+    for(int64_t node = 1; node < topology.n_nodes(); node++){
+        threads.emplace_back([&, node](){
+            topology.pin_thread(node);
+            PhaseClock clock;
+            throwing_ifstream in(indexfile, ios::binary);
+            load_string(in.stream); // Variant
+            replicas[node] = make_unique<sbwt_t>();
+            replicas[node]->load(in.stream);
+            clock.lap(Phase::INDEX);
+        });
+    }
+    for(thread& t : threads) t.join();
+    if(topology.n_nodes() > 1) cerr << "Index replicated on " << topology.n_nodes() << " NUMA nodes" << endl;
+    return replicas;
+}
+
+// Counts the k-mers of filenames[i] as color colors[i] with config.n_search_threads threads
+// that search chunks of the files (see WorkStealingScheduler), and updater threads that each
+// own a contiguous range of handles.
+// The ranges are spread over the NUMA nodes, so each counter is only written by a thread on
+// the node that holds it. Search threads send batches of handles to the owners of the ranges.
+// `replicas` has one index per node, or null to use `sbwt` on that node. If metadata is given,
+// adds the statistics of the files to their colors.
+template<typename sbwt_t>
+void count_kmers_numa(const sbwt_t& sbwt, const vector<unique_ptr<sbwt_t>>& replicas, const NumaTopology& topology,
+                      const NumaConfig& config, const vector<string>& filenames, const vector<int32_t>& colors,
+                      CounterTable& counters, HandleBitmap& kmer_handles_found, ColorMetadata* metadata = nullptr){
+
+    struct Batch{
+        int32_t color;
+        vector<int64_t> handles;
+    };
+
+    int64_t n_handles = counters.size();
+    int64_t n_partitions = topology.n_nodes() * config.updaters_per_node;
+    // Range boundaries are multiples of 64 so that no two updaters write the same word of the bitmap
+    int64_t range_size = max<int64_t>(64, ((n_handles + n_partitions - 1) / n_partitions + 63) / 64 * 64);
+    auto node_of_partition = [&](int64_t p){ return p / config.updaters_per_node; };
+
+    cerr << "Counting with " << config.n_search_threads << " search threads and " << n_partitions
+         << " updater threads on " << topology.n_nodes() << " NUMA nodes" << endl;
+
+    vector<unique_ptr<WorkQueue<Batch>>> queues;
+    for(int64_t p = 0; p < n_partitions; p++)
+        queues.push_back(make_unique<WorkQueue<Batch>>(4 * config.n_search_threads + 4));
+
+    vector<thread> updaters;
+    for(int64_t p = 0; p < n_partitions; p++){
+        updaters.emplace_back([&, p](){
+            int64_t node = node_of_partition(p);
+            topology.pin_thread(node);
+            int64_t begin = min(n_handles, p * range_size), end = min(n_handles, (p+1) * range_size);
+            if(begin < end) topology.bind_memory(counters.data() + begin, (end - begin) * sizeof(counters[0]), node);
+
+            PhaseClock clock;
+            Batch batch;
+            vector<int64_t> tmp;
+            while(queues[p]->pop(batch)){
+                clock.reset();
+                if(config.sort_batches){
+                    radix_sort_handles(batch.handles, tmp, n_handles - 1);
+                    add_sorted_handles(batch.handles, batch.color, counters, kmer_handles_found);
+                } else{
+                    for(int64_t handle : batch.handles){
+                        add_to_counter(counters[handle], batch.color, 1);
+                        kmer_handles_found[handle] = 1;
+                    }
+                }
+                clock.lap(Phase::UPDATE);
+            }
+        });
+    }
+
+    WorkStealingScheduler scheduler(make_work_items(filenames, colors, config.chunk_size), config.n_search_threads);
+    vector<thread> searchers;
+    mutex metadata_mutex;
+    for(int64_t t = 0; t < config.n_search_threads; t++){
+        searchers.emplace_back([&, t](){
+            int64_t node = t % topology.n_nodes();
+            topology.pin_thread(node);
+            const sbwt_t& index = replicas.size() > node && replicas[node] ? *replicas[node] : sbwt;
+
+            PhaseClock clock;
+            ThreadStats& stats = instrumentation().local();
+            vector<vector<int64_t>> buffers(n_partitions);
+            int32_t color = 0;
+            ColorMetadata local_metadata; // Merged at the end
+            ColorStats record;
+            auto on_length = [&](int64_t length){
+                record.records = 1;
+                record.bases = length;
+                local_metadata[color].add(record);
+                record = ColorStats();
+            };
+            auto flush = [&](int64_t p){
+                if(buffers[p].empty()) return;
+                queues[p]->push(Batch{color, std::move(buffers[p])});
+                buffers[p] = vector<int64_t>();
+                buffers[p].reserve(config.batch_size);
+            };
+
+            auto count_sequence = [&](const char* seq, int64_t length){
+                clock.lap(Phase::PARSE);
+                vector<int64_t> handles = index.streaming_search(seq, length);
+                clock.lap(Phase::SEARCH);
+
+                int64_t hits = 0;
+                for(int64_t handle : handles){
+                    if(handle == -1) continue;
+                    hits++;
+                    int64_t p = handle / range_size;
+                    buffers[p].push_back(handle);
+                    if(buffers[p].size() >= config.batch_size) flush(p);
+                }
+                clock.lap(Phase::UPDATE);
+
+                ThreadStats::add(stats.kmers_searched, handles.size());
+                ThreadStats::add(stats.hits, hits);
+                ThreadStats::add(stats.misses, handles.size() - hits);
+                record.kmers_searched += handles.size();
+                record.kmers_found += hits;
+            };
+            auto no_header = [](const char*, int64_t){};
+
+            WorkItem item;
+            while(scheduler.next(t, item)){
+                color = item.color;
+                const string& filename = filenames[item.file];
+                clock.reset();
+                if(item.whole) for_each_record(filename, index.get_k(), no_header, count_sequence, on_length);
+                else for_each_record(filename, index.get_k(), no_header, count_sequence, on_length,
+                                     find_record_start(filename, item.begin), find_record_start(filename, item.end));
+                clock.lap(Phase::PARSE);
+                for(int64_t p = 0; p < n_partitions; p++) flush(p); // The next item may have another color
+            }
+            if(metadata != nullptr){
+                lock_guard<mutex> lock(metadata_mutex);
+                metadata->merge(local_metadata);
+            }
+        });
+    }
+
+    for(thread& t : searchers) t.join();
+    for(auto& q : queues) q->close();
+    for(thread& t : updaters) t.join();
+}
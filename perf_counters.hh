@@ -0,0 +1,102 @@
+#pragma once
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+enum class PerfEvent{
+    CYCLES,
+    INSTRUCTIONS,
+    LLC_MISSES, // Last level cache read misses
+    DTLB_MISSES, // Data TLB read misses
+};
+static constexpr int64_t N_PERF_EVENTS = 4;
+static const char* PERF_EVENT_NAMES[N_PERF_EVENTS] = {"cycles", "instructions", "LLC misses", "dTLB misses"};
+
+// Hardware performance counters of the calling thread, opened as one perf_event_open group so
+// that all events are scheduled together and read with a single read(). Events the CPU or the
+// kernel does not support (e.g. in virtual machines) are left out and read as zero. User space
+// only, so that it works with the default perf_event_paranoid setting.
+class PerfCounterGroup{
+
+    int leader_fd = -1;
+    vector<int> fds;
+    vector<int64_t> event_of_fd; // PerfEvent index of each opened fd, in group order
+
+    static int open_event(uint32_t type, uint64_t config, int group_fd){
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = (group_fd == -1); // The leader starts the whole group
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP;
+        return syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0); // This thread, any CPU
+    }
+
+    static uint64_t cache_config(uint64_t cache, uint64_t op, uint64_t result){
+        return cache | (op << 8) | (result << 16);
+    }
+
+public:
+
+    PerfCounterGroup(){
+        struct { uint32_t type; uint64_t config; } events[N_PERF_EVENTS] = {
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+            {PERF_TYPE_HW_CACHE, cache_config(PERF_COUNT_HW_CACHE_LL, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS)},
+            {PERF_TYPE_HW_CACHE, cache_config(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS)},
+        };
+
+        for(int64_t e = 0; e < N_PERF_EVENTS; e++){
+            int fd = open_event(events[e].type, events[e].config, leader_fd);
+            if(fd == -1){
+                if(e == 0){
+                    cerr << "Warning: perf_event_open failed (" << strerror(errno) << "), hardware counters are disabled" << endl;
+                    return;
+                }
+                cerr << "Warning: hardware event " << PERF_EVENT_NAMES[e] << " is not available" << endl;
+                continue;
+            }
+            if(leader_fd == -1) leader_fd = fd;
+            fds.push_back(fd);
+            event_of_fd.push_back(e);
+        }
+
+        ioctl(leader_fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(leader_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+
+    PerfCounterGroup(const PerfCounterGroup&) = delete;
+    PerfCounterGroup& operator=(const PerfCounterGroup&) = delete;
+
+    bool is_open() const{
+        return leader_fd != -1;
+    }
+
+    // Stores the current value of each event to values. Returns false if the counters are not open.
+    bool read_values(int64_t values[N_PERF_EVENTS]) const{
+        for(int64_t e = 0; e < N_PERF_EVENTS; e++) values[e] = 0;
+        if(!is_open()) return false;
+
+        uint64_t buf[1 + N_PERF_EVENTS]; // The number of events, then their values in group order
+        if(::read(leader_fd, buf, sizeof(buf)) <= 0) return false;
+        for(uint64_t i = 0; i < buf[0] && i < event_of_fd.size(); i++) values[event_of_fd[i]] = buf[1 + i];
+        return true;
+    }
+
+    ~PerfCounterGroup(){
+        for(int fd : fds) close(fd);
+    }
+
+};
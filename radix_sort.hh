@@ -0,0 +1,36 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+using namespace std;
+
+// Sorts handles in [0, max_handle] with a least-significant-digit radix sort over only the bits
+// that max_handle needs, 11 bits (2048 buckets, which fit in L1) per pass. tmp is scratch
+// space that callers can reuse between calls. Small inputs are sorted with std::sort.
+static inline void radix_sort_handles(vector<int64_t>& handles, vector<int64_t>& tmp, int64_t max_handle){
+    if(handles.size() < 1024){
+        std::sort(handles.begin(), handles.end());
+        return;
+    }
+
+    const int64_t digit_bits = 11;
+    const int64_t n_buckets = int64_t(1) << digit_bits;
+    int64_t key_bits = 64 - __builtin_clzll(max<int64_t>(max_handle, 1));
+    tmp.resize(handles.size());
+    int64_t bucket_start[n_buckets];
+
+    for(int64_t shift = 0; shift < key_bits; shift += digit_bits){
+        std::fill(bucket_start, bucket_start + n_buckets, 0);
+        for(int64_t h : handles) bucket_start[(h >> shift) & (n_buckets - 1)]++;
+        int64_t sum = 0;
+        for(int64_t b = 0; b < n_buckets; b++){
+            int64_t count = bucket_start[b];
+            bucket_start[b] = sum;
+            sum += count;
+        }
+        for(int64_t h : handles) tmp[bucket_start[(h >> shift) & (n_buckets - 1)]++] = h;
+        handles.swap(tmp);
+    }
+}
@@ -0,0 +1,284 @@
+#pragma once
+
+#include "work_queue.hh"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#define COUNTERS_IO_URING
+#endif
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+static const string READ_AHEAD_USAGE =
+    "  --read-ahead n       Read up to n listed files into memory ahead of counting (default: 8, 0 = off)\n"
+    "  --read-backend name  io_uring or threads (default: io_uring where the kernel supports it)\n";
+
+enum class ReadBackend{IO_URING, THREADS};
+
+static inline ReadBackend parse_read_backend(const string& name){
+    if(name == "io_uring") return ReadBackend::IO_URING;
+    if(name == "threads") return ReadBackend::THREADS;
+    cerr << "Error: unknown read backend " << name << " (expected io_uring or threads)" << endl;
+    exit(1);
+}
+
+// An input file, possibly already read to memory by FileReadAhead
+struct InputFile{
+    string filename;
+    bool loaded = false;
+    vector<char> data; // The whole file if loaded
+
+    InputFile(){}
+    InputFile(const string& filename) : filename(filename){}
+    InputFile(const char* filename) : filename(filename){}
+};
+
+#ifdef COUNTERS_IO_URING
+// A minimal io_uring on the raw system calls, for one submitting thread and one reaping thread
+class IoUring{
+
+    int fd = -1;
+    void* sq_ring = MAP_FAILED;
+    void* cq_ring = MAP_FAILED;
+    io_uring_sqe* sqes = (io_uring_sqe*)MAP_FAILED;
+    size_t sq_ring_bytes = 0, cq_ring_bytes = 0, sqes_bytes = 0;
+    unsigned *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    io_uring_cqe* cqes;
+
+public:
+
+    // Check ok() afterwards: the kernel may not support io_uring or may forbid it
+    IoUring(unsigned entries){
+        io_uring_params p;
+        memset(&p, 0, sizeof(p));
+        fd = syscall(__NR_io_uring_setup, entries, &p);
+        if(fd < 0) return;
+        sq_ring_bytes = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        cq_ring_bytes = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        sqes_bytes = p.sq_entries * sizeof(io_uring_sqe);
+        sq_ring = mmap(nullptr, sq_ring_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        cq_ring = mmap(nullptr, cq_ring_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        sqes = (io_uring_sqe*)mmap(nullptr, sqes_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if(!ok()) return;
+        sq_tail = (unsigned*)((char*)sq_ring + p.sq_off.tail);
+        sq_mask = (unsigned*)((char*)sq_ring + p.sq_off.ring_mask);
+        sq_array = (unsigned*)((char*)sq_ring + p.sq_off.array);
+        cq_head = (unsigned*)((char*)cq_ring + p.cq_off.head);
+        cq_tail = (unsigned*)((char*)cq_ring + p.cq_off.tail);
+        cq_mask = (unsigned*)((char*)cq_ring + p.cq_off.ring_mask);
+        cqes = (io_uring_cqe*)((char*)cq_ring + p.cq_off.cqes);
+    }
+
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+
+    bool ok() const{
+        return fd >= 0 && sq_ring != MAP_FAILED && cq_ring != MAP_FAILED && sqes != MAP_FAILED;
+    }
+
+    // Submits one operation. The caller keeps the number in flight below the ring size.
+    void submit(uint8_t opcode, uint8_t flags, int file, void* buf, uint32_t len, uint64_t offset, uint64_t user_data){
+        unsigned tail = *sq_tail;
+        unsigned index = tail & *sq_mask;
+        io_uring_sqe& sqe = sqes[index];
+        memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = opcode;
+        sqe.flags = flags;
+        sqe.fd = file;
+        sqe.addr = (uint64_t)buf;
+        sqe.len = len;
+        sqe.off = offset;
+        sqe.user_data = user_data;
+        sq_array[index] = index;
+        __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+        while(syscall(__NR_io_uring_enter, fd, 1, 0, 0, nullptr, 0) < 0 && errno == EINTR);
+    }
+
+    // Waits for the next completion
+    io_uring_cqe wait(){
+        while(true){
+            unsigned head = *cq_head;
+            if(head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)){
+                io_uring_cqe cqe = cqes[head & *cq_mask];
+                __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+                return cqe;
+            }
+            syscall(__NR_io_uring_enter, fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+        }
+    }
+
+    ~IoUring(){
+        if(sqes != MAP_FAILED) munmap(sqes, sqes_bytes);
+        if(cq_ring != MAP_FAILED) munmap(cq_ring, cq_ring_bytes);
+        if(sq_ring != MAP_FAILED) munmap(sq_ring, sq_ring_bytes);
+        if(fd >= 0) close(fd);
+    }
+
+};
+#endif
+
+// Reads the files of a list into memory up to `files_ahead` files ahead of the consumer, so
+// that opening and reading the next files overlaps with counting the current one. With
+// io_uring, one thread opens the files and submits their reads, and another reaps the
+// completions, so all the reads are in flight at once. Otherwise a pool of `files_ahead`
+// threads reads one file each. Files larger than max_file_size, streams, and files that
+// cannot be read, are handed over unloaded and read as usual, which also reports any errors.
+class FileReadAhead{
+
+    struct Slot{
+        InputFile file;
+        int fd = -1;
+        promise<void> done;
+    };
+
+    WorkQueue<shared_ptr<Slot>> ordered; // All files in list order
+    WorkQueue<shared_ptr<Slot>> pending; // Files not yet taken by a reader thread
+    vector<thread> threads;
+    int64_t max_file_size;
+
+    // Opens the file and allocates its buffer. Returns false if it will not be read ahead.
+    // Standard input and named pipes are left to the parser unopened, since opening a pipe
+    // waits for its writer.
+    bool prepare(Slot& slot){
+        struct stat st;
+        if(slot.file.filename == "-" || stat(slot.file.filename.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) return false;
+        slot.fd = open(slot.file.filename.c_str(), O_RDONLY);
+        if(slot.fd < 0) return false;
+        if(fstat(slot.fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size > max_file_size){
+            close(slot.fd);
+            slot.fd = -1;
+            return false;
+        }
+        slot.file.data.resize(st.st_size);
+        return true;
+    }
+
+    // Reads the rest of the file from `offset` on with plain reads and closes it
+    static void finish(Slot& slot, int64_t offset){
+        while(offset < slot.file.data.size()){
+            ssize_t len = pread(slot.fd, slot.file.data.data() + offset, slot.file.data.size() - offset, offset);
+            if(len < 0 && errno == EINTR) continue;
+            if(len <= 0) break;
+            offset += len;
+        }
+        slot.file.loaded = offset == slot.file.data.size();
+        if(!slot.file.loaded) slot.file.data = vector<char>();
+        close(slot.fd);
+        slot.done.set_value();
+    }
+
+    void start_threads(const vector<string>& filenames, int64_t files_ahead){
+        threads.emplace_back([this, filenames](){
+            for(const string& filename : filenames){
+                auto slot = make_shared<Slot>();
+                slot->file.filename = filename;
+                if(!ordered.push(slot)) break; // The consumer stopped early
+                if(!prepare(*slot)) slot->done.set_value();
+                else pending.push(slot);
+            }
+            ordered.close();
+            pending.close();
+        });
+        for(int64_t t = 0; t < files_ahead; t++){
+            threads.emplace_back([this](){
+                shared_ptr<Slot> slot;
+                while(pending.pop(slot)) finish(*slot, 0);
+            });
+        }
+    }
+
+#ifdef COUNTERS_IO_URING
+    unique_ptr<IoUring> ring;
+
+    void start_io_uring(const vector<string>& filenames){
+        // The submitter pushes a file to `ordered` before submitting its read, so at most
+        // files_ahead + 1 reads are in flight
+        threads.emplace_back([this, filenames](){
+            for(const string& filename : filenames){
+                auto slot = make_shared<Slot>();
+                slot->file.filename = filename;
+                if(!ordered.push(slot)) break;
+                if(!prepare(*slot)) slot->done.set_value();
+                else{
+                    uint32_t len = min<int64_t>(slot->file.data.size(), 1 << 30);
+                    ring->submit(IORING_OP_READ, 0, slot->fd, slot->file.data.data(), len, 0, (uint64_t)slot.get());
+                }
+            }
+            ordered.close();
+            // Completes after all the reads, which ends the reaper
+            ring->submit(IORING_OP_NOP, IOSQE_IO_DRAIN, -1, nullptr, 0, 0, 0);
+        });
+        threads.emplace_back([this](){
+            while(true){
+                io_uring_cqe cqe = ring->wait();
+                if(cqe.user_data == 0) break;
+                // A short or failed read is finished with plain reads
+                finish(*(Slot*)cqe.user_data, max(cqe.res, 0));
+            }
+        });
+    }
+#endif
+
+public:
+
+    FileReadAhead(const vector<string>& filenames, int64_t files_ahead, ReadBackend backend, int64_t max_file_size = 64 << 20)
+        : ordered(files_ahead), pending(files_ahead), max_file_size(max_file_size){
+#ifdef COUNTERS_IO_URING
+        if(backend == ReadBackend::IO_URING){
+            ring = make_unique<IoUring>(files_ahead + 2);
+            if(ring->ok()){
+                start_io_uring(filenames);
+                return;
+            }
+            ring.reset();
+        }
+#endif
+        start_threads(filenames, files_ahead);
+    }
+
+    // Moves the next file of the list to `file`. Returns false after the last one.
+    bool next(InputFile& file){
+        shared_ptr<Slot> slot;
+        if(!ordered.pop(slot)) return false;
+        slot->done.get_future().wait();
+        file = std::move(slot->file);
+        return true;
+    }
+
+    ~FileReadAhead(){
+        // Wait for the reads in flight so that no thread writes to a freed buffer
+        ordered.close();
+        shared_ptr<Slot> slot;
+        while(ordered.pop(slot)) slot->done.get_future().wait();
+        for(thread& t : threads) t.join();
+    }
+
+};
+
+// Calls f(file, index) on each file of the list in order, reading files_ahead files ahead
+// with FileReadAhead, or none if files_ahead is 0
+template<typename F>
+void for_each_input_file(const vector<string>& filenames, int64_t files_ahead, ReadBackend backend, F f){
+    if(files_ahead <= 0){
+        for(int64_t i = 0; i < filenames.size(); i++) f(InputFile(filenames[i]), i);
+        return;
+    }
+    FileReadAhead read_ahead(filenames, files_ahead, backend);
+    InputFile file;
+    for(int64_t i = 0; read_ahead.next(file); i++) f(file, i);
+}
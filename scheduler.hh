@@ -0,0 +1,114 @@
+#pragma once
+
+#include "seq_parser.hh"
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// A piece of an input file: the records starting in bytes [begin, end) of the file, all of
+// the same color. Compressed files and streams are never split.
+struct WorkItem{
+    int64_t file; // Index to the list of files
+    int32_t color;
+    int64_t begin, end;
+    bool whole; // Read the whole file as one item
+
+    int64_t size() const{
+        return end - begin;
+    }
+};
+
+// Splits the uncompressed regular files into chunks of about chunk_size bytes. The boundaries are
+// moved to record starts by the workers (see find_record_start), so a chunk may end up
+// empty. The items are returned largest first, after the streams, whose size is not known.
+static inline vector<WorkItem> make_work_items(const vector<string>& filenames, const vector<int32_t>& colors, int64_t chunk_size){
+    vector<WorkItem> items;
+    for(int64_t i = 0; i < filenames.size(); i++){
+        if(is_stream(filenames[i])){
+            items.push_back({i, colors[i], 0, 0, true});
+            continue;
+        }
+        int64_t size = std::filesystem::file_size(filenames[i]);
+        bool gzipped = is_gzipped(filenames[i]);
+        if(gzipped || size <= chunk_size){
+            items.push_back({i, colors[i], 0, size, gzipped});
+            continue;
+        }
+        int64_t n_chunks = (size + chunk_size - 1) / chunk_size;
+        for(int64_t c = 0; c < n_chunks; c++)
+            items.push_back({i, colors[i], size * c / n_chunks, size * (c+1) / n_chunks, false});
+    }
+    std::stable_sort(items.begin(), items.end(), [](const WorkItem& a, const WorkItem& b){ return a.size() > b.size(); });
+    std::stable_partition(items.begin(), items.end(), [&](const WorkItem& item){ return is_stream(filenames[item.file]); });
+    return items;
+}
+
+// Work stealing over a fixed set of work items. The items are first dealt largest first to
+// the worker with the least work (longest processing time first), and each worker takes its
+// own items from the large end. A worker that runs out steals from the small end of the
+// worker with the most remaining work, so the run ends within about one small item of the
+// ideal total work / number of workers.
+class WorkStealingScheduler{
+
+    struct WorkerQueue{
+        mutex m;
+        deque<WorkItem> items; // Largest first
+        int64_t remaining_bytes = 0;
+    };
+
+    vector<unique_ptr<WorkerQueue>> queues;
+
+public:
+
+    WorkStealingScheduler(const vector<WorkItem>& items_largest_first, int64_t n_workers){
+        for(int64_t w = 0; w < n_workers; w++) queues.push_back(make_unique<WorkerQueue>());
+        for(const WorkItem& item : items_largest_first){
+            auto least_loaded = std::min_element(queues.begin(), queues.end(),
+                [](const auto& a, const auto& b){ return a->remaining_bytes < b->remaining_bytes; });
+            (*least_loaded)->items.push_back(item);
+            (*least_loaded)->remaining_bytes += item.size();
+        }
+    }
+
+    // Returns false when there is no work left anywhere
+    bool next(int64_t worker, WorkItem& item){
+        {
+            WorkerQueue& Q = *queues[worker];
+            lock_guard<mutex> lock(Q.m);
+            if(!Q.items.empty()){
+                item = Q.items.front();
+                Q.items.pop_front();
+                Q.remaining_bytes -= item.size();
+                return true;
+            }
+        }
+
+        while(true){
+            // The victim is the worker with the most remaining work
+            int64_t victim = -1, most = 0;
+            for(int64_t w = 0; w < queues.size(); w++){
+                lock_guard<mutex> lock(queues[w]->m);
+                if(!queues[w]->items.empty() && queues[w]->remaining_bytes >= most){
+                    victim = w;
+                    most = queues[w]->remaining_bytes;
+                }
+            }
+            if(victim == -1) return false;
+            WorkerQueue& V = *queues[victim];
+            lock_guard<mutex> lock(V.m);
+            if(V.items.empty()) continue; // Taken meanwhile
+            item = V.items.back();
+            V.items.pop_back();
+            V.remaining_bytes -= item.size();
+            return true;
+        }
+    }
+
+};
@@ -0,0 +1,311 @@
+#pragma once
+
+#include <algorithm>
+#include <sys/stat.h>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// A line that starts with this marker, followed by a color name, starts a new color in a
+// framed multi-color stream. It cannot be mistaken for a sequence line or, since it has a
+// space, for a FASTQ quality line.
+static const string FRAME_MARKER = "#SBWT-COLOR ";
+
+static inline bool is_frame_line(const char* line, int64_t length){
+    return length >= FRAME_MARKER.size() && memcmp(line, FRAME_MARKER.data(), FRAME_MARKER.size()) == 0;
+}
+
+// The length of the frame lines at the start of the data, after which the first record starts
+static inline int64_t leading_frames_length(const char* data, int64_t n){
+    int64_t first = 0;
+    while(first < n && is_frame_line(data + first, n - first)){
+        const char* newline = (const char*)memchr(data + first, '\n', n - first);
+        first = newline == nullptr ? n : newline - data + 1;
+    }
+    return first;
+}
+
+// True for standard input ("-") and for files that can only be read once from the start,
+// such as named pipes
+static inline bool is_stream(const string& filename){
+    struct stat st;
+    return filename == "-" || (stat(filename.c_str(), &st) == 0 && !S_ISREG(st.st_mode));
+}
+
+// True if the data starts with the gzip magic bytes
+static inline bool is_gzip_header(const unsigned char* data, int64_t n){
+    return n >= 2 && data[0] == 0x1f && data[1] == 0x8b;
+}
+
+// True if the file starts with the gzip magic bytes. Must not be called on streams, which it
+// would consume.
+static inline bool is_gzipped(const string& filename){
+    FILE* f = fopen(filename.c_str(), "rb");
+    if(f == nullptr) return false;
+    unsigned char magic[2] = {0, 0};
+    size_t n = fread(magic, 1, 2, f);
+    fclose(f);
+    return is_gzip_header(magic, n);
+}
+
+// A source of bytes: a file, or the output of a decompressor
+class InputStream{
+public:
+    // Reads up to n bytes to dest and returns the number of bytes read, or 0 at the end
+    virtual int64_t read(char* dest, int64_t n) = 0;
+    virtual ~InputStream(){}
+};
+
+// Reads until n bytes or the end of the stream and returns the number of bytes read
+static inline int64_t read_fully(InputStream& input, char* dest, int64_t n){
+    int64_t total = 0;
+    while(total < n){
+        int64_t len = input.read(dest + total, n - total);
+        if(len == 0) break;
+        total += len;
+    }
+    return total;
+}
+
+// Bytes in memory, such as a file read ahead by FileReadAhead. The data must outlive the stream.
+class MemoryInputStream : public InputStream{
+
+    const char* data;
+    int64_t size;
+    int64_t pos = 0;
+
+public:
+
+    MemoryInputStream(const char* data, int64_t size) : data(data), size(size){}
+
+    int64_t read(char* dest, int64_t n) override{
+        int64_t len = min(n, size - pos);
+        memcpy(dest, data + pos, len);
+        pos += len;
+        return len;
+    }
+
+};
+
+// An uncompressed file from the given offset on, or standard input if the filename is "-"
+class FileInputStream : public InputStream{
+
+    FILE* file;
+
+public:
+
+    FileInputStream(const string& filename, int64_t offset = 0){
+        if(filename == "-"){
+            file = stdin;
+            return;
+        }
+        file = fopen(filename.c_str(), "rb");
+        if(file == nullptr){
+            cerr << "Error: could not open " << filename << endl;
+            exit(1);
+        }
+        if(offset > 0) fseek(file, offset, SEEK_SET);
+    }
+
+    int64_t read(char* dest, int64_t n) override{
+        return fread(dest, 1, n, file);
+    }
+
+    ~FileInputStream(){
+        if(file != stdin) fclose(file);
+    }
+
+};
+
+// Bytes already read from a stream, followed by the rest of the stream. Used to look at the
+// start of a pipe without losing it.
+class PrefixedInputStream : public InputStream{
+
+    string prefix;
+    int64_t prefix_pos = 0;
+    unique_ptr<InputStream> rest;
+
+public:
+
+    PrefixedInputStream(string prefix, unique_ptr<InputStream> rest) : prefix(std::move(prefix)), rest(std::move(rest)){}
+
+    int64_t read(char* dest, int64_t n) override{
+        if(prefix_pos < prefix.size()){
+            int64_t len = min<int64_t>(n, prefix.size() - prefix_pos);
+            memcpy(dest, prefix.data() + prefix_pos, len);
+            prefix_pos += len;
+            return len;
+        }
+        return rest->read(dest, n);
+    }
+
+};
+
+// Reads the records of a FASTA or FASTQ stream. For an uncompressed file, it can also read the
+// records that start in the byte range [begin, end) of the file. `begin` must be the start of
+// a record (see find_record_start), and the last record may extend past `end`, so consecutive
+// ranges split at record starts read every record exactly once. Multi-line FASTA sequences are
+// concatenated. Frame lines (see FRAME_MARKER) end the previous record, and their color names
+// are collected in `frames`. Has the interface of seq_io::Reader: get_next_read_to_buffer returns the
+// length of the next sequence, stored in read_buf, or 0 when there are no more records.
+// It skips empty records, while next_record also returns those.
+class SeqParser{
+
+    unique_ptr<InputStream> input;
+    vector<char> buf;
+    int64_t buf_pos = 0, buf_len = 0;
+    int64_t offset; // Stream offset of buf[buf_pos]
+    int64_t end;
+    bool fastq = false;
+
+    string line; // Lookahead line
+    int64_t line_offset; // Stream offset of the start of `line`
+    bool have_line = false;
+    string seq;
+
+    // Reads the next line without the line break into `line`. Returns false at the end of the file.
+    bool read_line(){
+        line.clear();
+        line_offset = offset;
+        bool any = false;
+        while(true){
+            if(buf_pos == buf_len){
+                buf_len = input->read(buf.data(), buf.size());
+                buf_pos = 0;
+                if(buf_len == 0) break;
+            }
+            any = true;
+            const char* start = buf.data() + buf_pos;
+            const char* newline = (const char*)memchr(start, '\n', buf_len - buf_pos);
+            int64_t len = newline == nullptr ? buf_len - buf_pos : newline - start;
+            line.append(start, len);
+            buf_pos += len;
+            offset += len;
+            if(newline != nullptr){
+                buf_pos++;
+                offset++;
+                break;
+            }
+        }
+        if(line.size() > 0 && line.back() == '\r') line.pop_back();
+        return any;
+    }
+
+    // Advances to the next header line that starts before `end`
+    bool next_header(char marker){
+        if(!have_line) have_line = read_line();
+        while(have_line && (line.empty() || line[0] != marker)){
+            if(is_frame_line(line.data(), line.size()) && line_offset < end) frames.push_back(line.substr(FRAME_MARKER.size()));
+            have_line = read_line();
+        }
+        return have_line && line_offset < end;
+    }
+
+public:
+
+    const char* read_buf = nullptr;
+    string header; // Header line of the current record without the marker
+    string quality; // Quality line of the current FASTQ record
+    vector<string> frames; // Names of the frame lines before the current record, or at the end. Cleared by the caller.
+
+    SeqParser(unique_ptr<InputStream> input, int64_t begin = 0, int64_t end = INT64_MAX)
+        : input(std::move(input)), buf(1 << 20), offset(begin), end(end){
+        // Both formats start every record with their marker, so the first byte after any frame
+        // lines tells the format
+        buf_len = read_fully(*this->input, buf.data(), buf.size());
+        int64_t first = leading_frames_length(buf.data(), buf_len);
+        fastq = first < buf_len && buf[first] == '@';
+    }
+
+    SeqParser(const string& filename, int64_t begin = 0, int64_t end = INT64_MAX)
+        : SeqParser(make_unique<FileInputStream>(filename, begin), begin, end){}
+
+    SeqParser(const SeqParser&) = delete;
+    SeqParser& operator=(const SeqParser&) = delete;
+
+    // Reads the next record to `header` and read_buf. Returns its sequence length, or -1 when
+    // there are no more records.
+    int64_t next_record(){
+        seq.clear();
+        quality.clear();
+        if(!next_header(fastq ? '@' : '>')) return -1;
+        header.assign(line, 1);
+        if(fastq){
+            read_line(); // Sequence
+            seq = line;
+            read_line(); // +
+            read_line(); // Quality
+            quality = line;
+            have_line = false;
+        } else{
+            while((have_line = read_line()) && (line.empty() || line[0] != '>') && !is_frame_line(line.data(), line.size())) seq += line;
+        }
+        read_buf = seq.c_str();
+        return seq.size();
+    }
+
+    int64_t get_next_read_to_buffer(){
+        int64_t length;
+        while((length = next_record()) == 0);
+        return max<int64_t>(length, 0);
+    }
+
+};
+
+// The offset of the first record that starts at or after `offset` in an uncompressed FASTA or
+// FASTQ file, or the file size if there is none. In FASTQ, a line starting with '@' is a
+// header only if the line two below it starts with '+', since quality lines can also start
+// with '@'.
+static inline int64_t find_record_start(const string& filename, int64_t offset){
+    FILE* f = fopen(filename.c_str(), "rb");
+    if(f == nullptr) return offset;
+    bool fastq = fgetc(f) == '@';
+    if(offset == 0){
+        fclose(f);
+        return 0;
+    }
+
+    // Start from the beginning of the first full line at or after offset
+    fseek(f, offset - 1, SEEK_SET);
+    int64_t pos = offset - 1;
+    int c;
+    while((c = fgetc(f)) != EOF && c != '\n') pos++;
+    pos++;
+    if(c == EOF){
+        fclose(f);
+        return pos;
+    }
+
+    // Scan lines, remembering the offset and first character of the last three
+    vector<pair<int64_t, int>> window; // (line start, first character)
+    string line;
+    while(true){
+        int64_t line_start = pos;
+        line.clear();
+        while((c = fgetc(f)) != EOF && c != '\n') line += (char)c;
+        pos += line.size() + 1;
+        if(line.empty() && c == EOF) break;
+        int first = line.empty() ? 0 : line[0];
+        if(!fastq && first == '>'){
+            fclose(f);
+            return line_start;
+        }
+        window.push_back({line_start, first});
+        if(fastq && window.size() >= 3){
+            auto [header_start, header_first] = window[window.size() - 3];
+            if(header_first == '@' && window.back().second == '+'){
+                fclose(f);
+                return header_start;
+            }
+        }
+        if(c == EOF) break;
+    }
+    fclose(f);
+    return pos - 1; // The file size
+}
@@ -1,20 +1,46 @@
 #include "sbwt/SBWT.hh"
 #include "sbwt/variants.hh"
+#include "cli.hh"
+#include "counters.hh"
+#include "counters_output.hh"
+#include "dense_counters.hh"
+#include "numa.hh"
+#include "stats.hh"
 
 using namespace sbwt;
 
 typedef plain_matrix_sbwt_t sbwt_t;
 
-struct Counter{
-
-    int32_t color;
-    int32_t count;
+int main(int argc, char** argv){
 
-};
+    CommandLine args(argc, argv, {"with-kmers", "binary", "unitigs", "perf", "numa", "numa-replicate-index", "dense"},
+                     {"progress", "huge-pages", "color-metadata", "batch-size", "min-quality", "decompression-threads",
+                      "n-threads", "numa-updaters", "chunk-size", "dense-updates"});
+    if(args.positional.size() < 2){
+        cerr << "Usage: " << argv[0] << " index.sbwt seqfile1 [seqfile2 ...] [--with-kmers [--binary] | --unitigs] [--progress seconds] [--perf] [--huge-pages mode] [--numa ... | --dense ...]" << endl;
+        cerr << OUTPUT_FORMAT_USAGE;
+        cerr << COLOR_METADATA_USAGE;
+        cerr << BATCH_SIZE_USAGE;
+        cerr << MIN_QUALITY_USAGE;
+        cerr << DECOMPRESSION_USAGE;
+        cerr << HUGE_PAGES_USAGE;
+        cerr << NUMA_USAGE;
+        cerr << DENSE_USAGE;
+        return 1;
+    }
 
-int main(int argc, char** argv){
+    OutputFormat format = parse_output_format(args);
+    if(args.has("numa") && args.has("dense")){
+        cerr << "Error: --numa can not be combined with --dense" << endl;
+        return 1;
+    }
+    if(args.has("progress")) instrumentation().start_progress(args.get_int("progress", 10));
+    if(args.has("perf")) instrumentation().enable_perf();
+    if(args.has("huge-pages")) huge_pages_mode() = parse_huge_pages(args.get("huge-pages", "off"));
+    if(args.has("decompression-threads")) decompression_threads() = args.get_int("decompression-threads", 4);
+    if(args.has("min-quality")) min_base_quality() = parse_min_quality(args.get_int("min-quality", 0));
 
-    string indexfile = argv[1];
+    string indexfile = args.positional[0];
 
     throwing_ifstream in(indexfile, ios::binary);
     string variant = load_string(in.stream); // read variant type
@@ -23,52 +49,70 @@ int main(int argc, char** argv){
         return 1;
     }
 
+    NumaTopology topology = NumaTopology::detect();
+    if(args.has("numa")) topology.pin_thread(0); // The index is loaded on the first node
+
     cerr << "Loading SBWT from " << indexfile << endl;
+    bool replicate = args.has("numa") && args.has("numa-replicate-index");
+    reserve_huge_pages_for_index(indexfile, replicate ? topology.n_nodes() : 1);
+    PhaseClock clock;
     sbwt_t sbwt;
     sbwt.load(in.stream);
+    advise_huge_pages_for_index(sbwt);
+    clock.lap(Phase::INDEX);
 
     cerr << "SBWT loaded" << endl;
 
+    vector<unique_ptr<sbwt_t>> replicas;
+    if(replicate) replicas = load_index_replicas<sbwt_t>(indexfile, topology);
+
     int64_t sbwt_length = sbwt.number_of_subsets();
 
-    vector<vector<Counter>> counters(sbwt_length); // K-mer handle -> list of counters
-
-    vector<bool> kmer_handles_found(sbwt_length); // Bit vector that marks which k-mer handles have at least 1 counter
-
-    // Arguments 2..(argc-1) are sequence files from which we want to compute the k-mer counts
-    for(int64_t i = 2; i < argc; i++){
-        int32_t color = i - 2; 
-        string filename = argv[i];
-        seq_io::Reader<> reader(filename);
-        while(true){
-            int64_t length = reader.get_next_read_to_buffer();
-            if(length == 0) break; // All sequences have been read
-
-            const char* seq = reader.read_buf; // The DNA sequence
-
-            // Search all k-mers of seq
-            vector<int64_t> handles = sbwt.streaming_search(seq, length);
-
-            for(int64_t handle : handles){
-                if(handle == -1) continue; // This k-mer does not exist in the index
-                if(counters[handle].size() == 0 || counters[handle].back().color != color){
-                    // No counter yet for this k-mer and this color
-                    Counter C = {.color = color, .count = 0}; // Create a counter
-                    counters[handle].push_back(C);
-                    kmer_handles_found[handle] = 1;
-                }
-                counters[handle].back().count++; // Add to the count of this color in this k-mer
-            }
+    CounterTable counters(sbwt_length); // K-mer handle -> list of counters
+
+    HandleBitmap kmer_handles_found(sbwt_length); // Bit vector that marks which k-mer handles have at least 1 counter
+
+    ColorMetadata metadata; // Collected while counting, written if --color-metadata is given
+
+    // Positional arguments 1..end are sequence files from which we want to compute the k-mer counts
+    if(args.has("numa")){
+        vector<string> filenames(args.positional.begin() + 1, args.positional.end());
+        vector<int32_t> colors;
+        for(int32_t color = 0; color < filenames.size(); color++) colors.push_back(color);
+        int64_t updaters_per_node = args.get_int("numa-updaters", 1);
+        // By default the search threads take the CPUs that the updaters leave free
+        int64_t default_search_threads = max<int64_t>(1, topology.n_cpus() - topology.n_nodes() * updaters_per_node);
+        NumaConfig config = {.n_search_threads = args.get_int("n-threads", default_search_threads),
+                             .updaters_per_node = updaters_per_node};
+        config.chunk_size = args.get_int("chunk-size", config.chunk_size);
+        if(args.get_int("batch-size", 0) > 0){
+            config.batch_size = args.get_int("batch-size", 0);
+            config.sort_batches = true;
         }
-    }
-
-    for(int64_t i = 0; i < counters.size(); i++){
-        if(kmer_handles_found[i]){
-            cout << i;
-            for(Counter C : counters[i]){
-                cout << " (" << C.color << ": " << C.count << ")";
-            }
-            cout << "\n";
+        count_kmers_numa(sbwt, replicas, topology, config, filenames, colors, counters, kmer_handles_found, &metadata);
+    } else if(args.has("dense")){
+        // Every file in turn with all threads, for a few large files
+        int64_t n_threads = args.get_int("n-threads", std::thread::hardware_concurrency());
+        DenseUpdates updates = parse_dense_updates(args.get("dense-updates", "atomic"));
+        DenseCounts counts(sbwt_length, 0);
+        for(int64_t i = 1; i < args.positional.size(); i++){
+            int32_t color = i - 1;
+            count_kmers_dense(sbwt, args.positional[i], counts, n_threads, updates, args.get_int("batch-size", 1 << 20), &metadata[color]);
+            append_dense_counts(counts, color, counters, kmer_handles_found);
+        }
+    } else{
+        for(int64_t i = 1; i < args.positional.size(); i++){
+            int32_t color = i - 1; 
+            count_kmers_in_file(sbwt, args.positional[i], color, counters, kmer_handles_found, args.get_int("batch-size", 0), &metadata);
         }
     }
+    if(args.has("color-metadata")){
+        ColorNames names;
+        for(int64_t i = 1; i < args.positional.size(); i++) names.add(args.positional[i]);
+        metadata.write(args.get("color-metadata", ""), names);
+    }
+
+    write_counters_output(cout, sbwt, counters, kmer_handles_found, format);
+
+    instrumentation().report(cerr);
 }
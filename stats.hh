@@ -0,0 +1,237 @@
+#pragma once
+
+#include "perf_counters.hh"
+#include <sys/resource.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+enum class Phase{
+    INDEX, // Loading or building the index
+    PARSE, // Reading and parsing the input sequences
+    SEARCH, // streaming_search
+    UPDATE, // Updating the counters
+    OUTPUT, // Reconstructing k-mers and writing the output
+};
+static constexpr int64_t N_PHASES = 5;
+static const char* PHASE_NAMES[N_PHASES] = {"index load", "input parsing", "search", "counter update", "output"};
+
+// Counters of one thread. Only the owning thread writes them, with a relaxed load and store
+// instead of a locked read-modify-write, so they are as cheap as plain integers. Other threads
+// only read them for the progress lines and the final report.
+struct ThreadStats{
+
+    atomic<int64_t> phase_nanos[N_PHASES] = {};
+    atomic<int64_t> reads = 0;
+    atomic<int64_t> kmers_searched = 0;
+    atomic<int64_t> hits = 0;
+    atomic<int64_t> misses = 0;
+    atomic<int64_t> perf_values[N_PHASES][N_PERF_EVENTS] = {}; // Hardware counters, with --perf only
+
+    static void add(atomic<int64_t>& x, int64_t delta){
+        x.store(x.load(memory_order_relaxed) + delta, memory_order_relaxed);
+    }
+
+};
+
+// Process-wide instrumentation: per-thread counters, the final report and optional periodic
+// progress lines on stderr.
+class Instrumentation{
+
+    mutex threads_mutex;
+    vector<unique_ptr<ThreadStats>> threads; // Kept until exit so that the totals include finished threads
+    chrono::steady_clock::time_point start_time = chrono::steady_clock::now();
+
+    thread progress_thread;
+    mutex progress_mutex;
+    condition_variable progress_cv;
+    bool stop_progress_thread = false;
+
+    atomic<bool> perf_enabled = false;
+
+public:
+
+    struct Totals{
+        int64_t phase_nanos[N_PHASES] = {};
+        int64_t reads = 0, kmers_searched = 0, hits = 0, misses = 0;
+        int64_t perf_values[N_PHASES][N_PERF_EVENTS] = {};
+    };
+
+    // Makes every PhaseClock created after this call also attribute hardware counter deltas
+    // to the phases. Each lap then costs a read() system call, so this is off by default.
+    void enable_perf(){
+        perf_enabled = true;
+    }
+
+    // The hardware counters of the calling thread, or null if --perf is off
+    PerfCounterGroup* local_perf(){
+        if(!perf_enabled) return nullptr;
+        thread_local unique_ptr<PerfCounterGroup> group;
+        if(!group) group = make_unique<PerfCounterGroup>();
+        return group->is_open() ? group.get() : nullptr;
+    }
+
+    ThreadStats& local(){
+        thread_local ThreadStats* stats = nullptr;
+        if(stats == nullptr){
+            lock_guard<mutex> lock(threads_mutex);
+            threads.push_back(make_unique<ThreadStats>());
+            stats = threads.back().get();
+        }
+        return *stats;
+    }
+
+    Totals totals(){
+        lock_guard<mutex> lock(threads_mutex);
+        Totals T;
+        for(const auto& S : threads){
+            for(int64_t p = 0; p < N_PHASES; p++) T.phase_nanos[p] += S->phase_nanos[p].load(memory_order_relaxed);
+            T.reads += S->reads.load(memory_order_relaxed);
+            T.kmers_searched += S->kmers_searched.load(memory_order_relaxed);
+            T.hits += S->hits.load(memory_order_relaxed);
+            T.misses += S->misses.load(memory_order_relaxed);
+            for(int64_t p = 0; p < N_PHASES; p++)
+                for(int64_t e = 0; e < N_PERF_EVENTS; e++)
+                    T.perf_values[p][e] += S->perf_values[p][e].load(memory_order_relaxed);
+        }
+        return T;
+    }
+
+    double elapsed_seconds() const{
+        return chrono::duration<double>(chrono::steady_clock::now() - start_time).count();
+    }
+
+    static int64_t peak_rss_kb(){
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_maxrss;
+    }
+
+    // Prints a progress line every `seconds` seconds until stop_progress is called
+    void start_progress(int64_t seconds){
+        progress_thread = thread([this, seconds](){
+            unique_lock<mutex> lock(progress_mutex);
+            while(!progress_cv.wait_for(lock, chrono::seconds(seconds), [this](){ return stop_progress_thread; })){
+                Totals T = totals();
+                double elapsed = elapsed_seconds();
+                cerr << fixed << setprecision(1) << "progress: " << elapsed << " s, " << T.reads << " reads, "
+                     << T.kmers_searched << " k-mers searched (" << T.kmers_searched / elapsed << " k-mers/s), "
+                     << "peak RSS " << peak_rss_kb() / 1024 << " MB" << defaultfloat << endl;
+            }
+        });
+    }
+
+    void stop_progress(){
+        if(!progress_thread.joinable()) return;
+        {
+            lock_guard<mutex> lock(progress_mutex);
+            stop_progress_thread = true;
+        }
+        progress_cv.notify_all();
+        progress_thread.join();
+    }
+
+    void report(ostream& out){
+        stop_progress();
+        Totals T = totals();
+        double counting_seconds = (T.phase_nanos[(int)Phase::PARSE] + T.phase_nanos[(int)Phase::SEARCH]
+                                   + T.phase_nanos[(int)Phase::UPDATE]) / 1e9;
+        out << "== Statistics ==" << endl;
+        out << fixed << setprecision(3);
+        for(int64_t p = 0; p < N_PHASES; p++)
+            out << setw(16) << left << PHASE_NAMES[p] << T.phase_nanos[p] / 1e9 << " s (summed over threads)" << endl;
+        out << setw(16) << left << "wall time" << elapsed_seconds() << " s" << endl;
+        out << "reads: " << T.reads << ", k-mers searched: " << T.kmers_searched << ", hits: " << T.hits
+            << ", misses: " << T.misses << endl;
+        if(counting_seconds > 0){
+            out << setprecision(0) << "throughput: " << T.kmers_searched / elapsed_seconds() << " k-mers/s of wall time, "
+                << T.kmers_searched / counting_seconds << " k-mers/s and " << T.reads / counting_seconds
+                << " reads/s per counting thread" << endl;
+        }
+        out << "peak RSS: " << peak_rss_kb() / 1024 << " MB" << endl;
+        out << defaultfloat << right;
+        if(perf_enabled) report_perf(out, T);
+    }
+
+    // IPC and misses per searched k-mer for each phase that ran with hardware counters
+    static void report_perf(ostream& out, const Totals& T){
+        out << "== Hardware counters ==" << endl;
+        out << fixed;
+        bool any = false;
+        for(int64_t p = 0; p < N_PHASES; p++){
+            const int64_t* v = T.perf_values[p];
+            int64_t cycles = v[(int)PerfEvent::CYCLES];
+            if(cycles == 0) continue;
+            any = true;
+            out << setw(16) << left << PHASE_NAMES[p] << right;
+            for(int64_t e = 0; e < N_PERF_EVENTS; e++) out << " " << PERF_EVENT_NAMES[e] << ": " << v[e] << ",";
+            out << setprecision(2) << " IPC: " << (double)v[(int)PerfEvent::INSTRUCTIONS] / cycles;
+            if(T.kmers_searched > 0){
+                out << setprecision(3) << ", per k-mer: " << (double)cycles / T.kmers_searched << " cycles, "
+                    << (double)v[(int)PerfEvent::LLC_MISSES] / T.kmers_searched << " LLC misses, "
+                    << (double)v[(int)PerfEvent::DTLB_MISSES] / T.kmers_searched << " dTLB misses";
+            }
+            out << endl;
+        }
+        if(!any) out << "not available" << endl;
+        out << defaultfloat;
+    }
+
+    ~Instrumentation(){
+        stop_progress();
+    }
+
+};
+
+static inline Instrumentation& instrumentation(){
+    static Instrumentation I;
+    return I;
+}
+
+// Attributes the time between consecutive laps to phases of the current thread, so that
+// back-to-back phases cost one clock read each. With --perf, the hardware counter deltas are
+// attributed the same way.
+class PhaseClock{
+
+    ThreadStats& stats;
+    chrono::steady_clock::time_point last;
+    PerfCounterGroup* perf;
+    int64_t last_perf[N_PERF_EVENTS];
+
+public:
+
+    PhaseClock() : stats(instrumentation().local()), last(chrono::steady_clock::now()), perf(instrumentation().local_perf()){
+        if(perf != nullptr) perf->read_values(last_perf);
+    }
+
+    // Starts timing from now without attributing the time since the previous lap
+    void reset(){
+        last = chrono::steady_clock::now();
+        if(perf != nullptr) perf->read_values(last_perf);
+    }
+
+    // Adds the time since the previous lap (or construction) to phase p
+    void lap(Phase p){
+        auto now = chrono::steady_clock::now();
+        ThreadStats::add(stats.phase_nanos[(int)p], chrono::duration_cast<chrono::nanoseconds>(now - last).count());
+        last = now;
+        if(perf != nullptr){
+            int64_t values[N_PERF_EVENTS];
+            perf->read_values(values);
+            for(int64_t e = 0; e < N_PERF_EVENTS; e++){
+                ThreadStats::add(stats.perf_values[(int)p][e], values[e] - last_perf[e]);
+                last_perf[e] = values[e];
+            }
+        }
+    }
+
+};
@@ -0,0 +1,176 @@
+#pragma once
+
+#include "sbwt/SBWT.hh"
+#include "counters.hh"
+#include "kmer_labels.hh"
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace sbwt;
+
+// The de Bruijn graph of the k-mers in an SBWT. Only the first node of each suffix group
+// (nodes whose labels share the last k-1 characters) stores its outgoing edges, so degrees
+// are looked up at the group start. Dummy nodes are not counted as in-neighbors.
+template<typename sbwt_t>
+class SBWTGraph{
+
+    const sbwt_t& sbwt;
+    int64_t n_nodes;
+    vector<int64_t> C_array; // Nodes with incoming character c are C_array[c]..C_array[c+1]-1
+    sdsl::bit_vector group_starts;
+    vector<uint8_t> outdeg; // Out-degree of each group start
+    vector<uint8_t> indeg; // Number of non-dummy in-neighbors of each node
+
+public:
+
+    SBWTGraph(const sbwt_t& sbwt, const sdsl::bit_vector& dummy_mask) : sbwt(sbwt), n_nodes(sbwt.number_of_subsets()){
+        const auto& subset_rank = sbwt.get_subset_rank_structure();
+        SubsetBits<std::remove_cvref_t<decltype(subset_rank)>> bits(subset_rank, n_nodes);
+
+        if(sbwt.get_streaming_support().size() == n_nodes){
+            group_starts = sbwt.get_streaming_support();
+        } else{
+            // Index built without streaming support: a group starts where the last k-1
+            // characters differ from the previous node
+            cerr << "Computing suffix groups" << endl;
+            group_starts = sdsl::bit_vector(n_nodes, 0);
+            group_starts[0] = 1;
+            propagate_labels(subset_rank, n_nodes, sbwt.get_k(), [&](int64_t pos, const vector<char>& labels){
+                if(pos == 0) return;
+                for(int64_t i = 1; i < n_nodes; i++) if(labels[i] != labels[i-1]) group_starts[i] = 1;
+            });
+        }
+
+        outdeg.resize(n_nodes, 0);
+        C_array.push_back(1); // Node 0 is the root, which has no incoming character
+        for(int64_t c = 0; c < 4; c++){
+            int64_t n_edges = 0;
+            bits.for_each(c, [&](int64_t i){ outdeg[i]++; n_edges++; });
+            C_array.push_back(C_array.back() + n_edges);
+        }
+
+        // Number of non-dummy nodes in the group of each group start
+        vector<uint8_t> real_group_size(n_nodes, 0);
+        int64_t group_start = 0;
+        for(int64_t i = 0; i < n_nodes; i++){
+            if(group_starts[i]) group_start = i;
+            if(!dummy_mask[i]) real_group_size[group_start]++;
+        }
+
+        // The targets of the edges labeled with c are consecutive starting from C_array[c]
+        indeg.resize(n_nodes, 0);
+        for(int64_t c = 0; c < 4; c++){
+            int64_t ptr = C_array[c];
+            bits.for_each(c, [&](int64_t i){ indeg[ptr++] = real_group_size[i]; });
+        }
+    }
+
+    int64_t group_start(int64_t v) const{
+        while(!group_starts[v]) v--;
+        return v;
+    }
+
+    int64_t outdegree(int64_t v) const{
+        return outdeg[group_start(v)];
+    }
+
+    int64_t indegree(int64_t v) const{
+        return indeg[v];
+    }
+
+    // The last character of the label of v
+    char incoming_char(int64_t v) const{
+        for(int64_t c = 3; c >= 0; c--) if(v >= C_array[c]) return "ACGT"[c];
+        return '$';
+    }
+
+    // The successor of v if v has out-degree 1, otherwise -1
+    int64_t unique_successor(int64_t v) const{
+        const auto& subset_rank = sbwt.get_subset_rank_structure();
+        int64_t u = group_start(v);
+        if(outdeg[u] != 1) return -1;
+        for(int64_t c = 0; c < 4; c++){
+            char ch = "ACGT"[c];
+            int64_t r = subset_rank.rank(u, ch);
+            if(subset_rank.rank(u+1, ch) != r) return C_array[c] + r;
+        }
+        return -1;
+    }
+
+};
+
+static inline bool same_counters(const vector<Counter>& A, const vector<Counter>& B){
+    if(A.size() != B.size()) return false;
+    for(int64_t i = 0; i < A.size(); i++)
+        if(A[i].color != B[i].color || A[i].count != B[i].count) return false;
+    return true;
+}
+
+// Writes maximal non-branching paths of found k-mers with identical counters as one row each:
+// the spelled sequence followed by the shared (color: count) pairs. Paths are cut where a node
+// has out-degree other than 1, its successor has in-degree other than 1, or the counters change.
+template<typename sbwt_t>
+void write_unitigs(ostream& out, const sbwt_t& sbwt, const CounterTable& counters,
+                   const HandleBitmap& kmer_handles_found){
+
+    int64_t n_nodes = sbwt.number_of_subsets();
+
+    cerr << "Reconstructing the k-mers of the found handles" << endl;
+    PackedKmers P = extract_packed_kmers(sbwt, &kmer_handles_found);
+
+    // Record index of each found handle in P
+    sdsl::bit_vector found(n_nodes, 0);
+    for(int64_t i = 0; i < n_nodes; i++) found[i] = kmer_handles_found[i];
+    sdsl::rank_support_v5<> found_rs(&found);
+
+    cerr << "Building the de Bruijn graph" << endl;
+    SBWTGraph<sbwt_t> graph(sbwt, P.dummy_mask);
+
+    // The node following u in its unitig, or -1 if the unitig ends at u
+    auto next_in_unitig = [&](int64_t u) -> int64_t {
+        int64_t v = graph.unique_successor(u);
+        if(v == -1 || v == u || !found[v] || graph.indegree(v) != 1) return -1;
+        if(!same_counters(counters[u], counters[v])) return -1;
+        return v;
+    };
+    sdsl::bit_vector extends(n_nodes, 0); // extends[v] = 1 iff v continues the unitig of its predecessor
+    for(int64_t u = 0; u < n_nodes; u++){
+        if(!found[u]) continue;
+        int64_t v = next_in_unitig(u);
+        if(v != -1) extends[v] = 1;
+    }
+
+    sdsl::bit_vector visited(n_nodes, 0);
+    int64_t n_unitigs = 0, n_kmers = 0;
+    auto output_unitig = [&](int64_t start){
+        string seq = P.to_string(found_rs(start));
+        visited[start] = 1;
+        int64_t v = next_in_unitig(start);
+        while(v != -1 && extends[v] && !visited[v]){
+            seq += graph.incoming_char(v);
+            visited[v] = 1;
+            v = next_in_unitig(v);
+        }
+        out << seq;
+        for(Counter C : counters[start]){
+            out << " (" << C.color << ": " << C.count << ")";
+        }
+        out << "\n";
+        n_unitigs++;
+        n_kmers += seq.size() - P.k + 1;
+    };
+
+    for(int64_t v = 0; v < n_nodes; v++)
+        if(found[v] && !extends[v]) output_unitig(v);
+
+    // What remains are cycles where every node extends its predecessor
+    for(int64_t v = 0; v < n_nodes; v++)
+        if(found[v] && !visited[v]) output_unitig(v);
+
+    out.flush();
+    cerr << "Wrote " << n_kmers << " k-mers as " << n_unitigs << " unitigs";
+    if(n_unitigs > 0) cerr << " (average " << (double)n_kmers / n_unitigs << " k-mers per unitig)";
+    cerr << endl;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+
+using namespace std;
+
+// Bounded multi-producer multi-consumer queue. push blocks while the queue is full, and pop
+// blocks until an item is available or the queue is closed and drained. Closing also makes
+// blocked and later pushes return false, so a consumer can stop its producers early.
+template<typename T>
+class WorkQueue{
+
+    mutex m;
+    condition_variable not_empty, not_full;
+    deque<T> items;
+    int64_t capacity;
+    bool closed = false;
+
+public:
+
+    WorkQueue(int64_t capacity) : capacity(capacity){}
+
+    // Returns false if the queue was closed and the item was dropped
+    bool push(T item){
+        unique_lock<mutex> lock(m);
+        not_full.wait(lock, [&](){ return items.size() < capacity || closed; });
+        if(closed) return false;
+        items.push_back(std::move(item));
+        lock.unlock();
+        not_empty.notify_one();
+        return true;
+    }
+
+    // Returns false once the queue is closed and empty
+    bool pop(T& item){
+        unique_lock<mutex> lock(m);
+        not_empty.wait(lock, [&](){ return !items.empty() || closed; });
+        if(items.empty()) return false;
+        item = std::move(items.front());
+        items.pop_front();
+        lock.unlock();
+        not_full.notify_one();
+        return true;
+    }
+
+    // No more items will be pushed
+    void close(){
+        {
+            lock_guard<mutex> lock(m);
+            closed = true;
+        }
+        not_empty.notify_all();
+        not_full.notify_all();
+    }
+
+};